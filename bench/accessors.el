@@ -0,0 +1,54 @@
+;;; accessors.el --- Time the cost of small yeast accessors. -*- lexical-binding: t; -*-
+
+;;; Commentary:
+
+;; Run from the repository root, after building the module:
+;;
+;;   emacs -Q --batch -l bench/accessors.el
+;;
+;; Prints the time per call, in nanoseconds, for each accessor. To compare
+;; before and after a change, run it with the module built from both trees.
+
+;;; Code:
+
+(load-file (expand-file-name "yeast.el"))
+
+(defvar yeast-bench-iterations 1000000
+  "Number of calls to time for each accessor.")
+
+(defun yeast-bench--source ()
+  "Return some C code to parse."
+  (mapconcat
+   (lambda (i) (format "int f%d(int x) { return x * %d + 1; }\n" i i))
+   (number-sequence 1 200) ""))
+
+(defmacro yeast-bench--time (name form)
+  "Print the time per evaluation of FORM in nanoseconds, labelled with NAME."
+  `(progn
+     (garbage-collect)
+     (let* ((result (benchmark-run-compiled yeast-bench-iterations ,form))
+            (ns (/ (* 1e9 (- (car result) (nth 2 result))) yeast-bench-iterations)))
+       (princ (format "%-28s %8.1f ns/call  (%d GCs)\n" ,name ns (nth 1 result))))))
+
+(with-temp-buffer
+  (insert (yeast-bench--source))
+  (let* ((instance (yeast--make-instance 'c))
+         (_ (yeast--parse instance))
+         (tree (yeast--instance-tree instance))
+         (root (yeast--tree-root tree))
+         (node (yeast--node-child root 0))
+         (cursor (yeast--cursor-new root)))
+    (yeast-bench--time "yeast-node-p" (yeast-node-p node))
+    (yeast-bench--time "yeast--node-type" (yeast--node-type node))
+    (yeast-bench--time "yeast--node-symbol" (yeast--node-symbol node))
+    (yeast-bench--time "yeast--node-child-count" (yeast--node-child-count node))
+    (yeast-bench--time "yeast--node-start-byte" (yeast--node-start-byte node))
+    (yeast-bench--time "yeast--node-end-byte" (yeast--node-end-byte node))
+    (yeast-bench--time "yeast--node-byte-range" (yeast--node-byte-range node))
+    (yeast-bench--time "yeast--node-start" (yeast--node-start node))
+    (yeast-bench--time "yeast--node-range" (yeast--node-range node))
+    (yeast-bench--time "yeast--node-child" (yeast--node-child root 0))
+    (yeast-bench--time "yeast--cursor-type" (yeast--cursor-type cursor))
+    (yeast-bench--time "yeast--cursor-named-p" (yeast--cursor-named-p cursor))))
+
+;;; accessors.el ends here
@@ -0,0 +1,851 @@
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "emacs-module.h"
+
+#include "fake-env.h"
+
+// With YEAST_BENCH_WRAP_MALLOC, the executable is linked with
+// -Wl,--wrap=malloc (and calloc, realloc), so that every allocation made
+// by libyeast and the tree-sitter runtime is counted. The environment's own
+// allocations bypass the counter.
+#ifdef YEAST_BENCH_WRAP_MALLOC
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+
+static uint64_t allocs = 0;
+
+void *__wrap_malloc(size_t size)
+{
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size)
+{
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size)
+{
+    __atomic_add_fetch(&allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+#define ALLOC(size) __real_malloc(size)
+#define REALLOC(ptr, size) __real_realloc((ptr), (size))
+#else
+#define ALLOC(size) malloc(size)
+#define REALLOC(ptr, size) realloc((ptr), (size))
+#endif
+
+// The symbol table must not be counted either
+#define uthash_malloc(size) ALLOC(size)
+#include "uthash.h"
+
+typedef emacs_value (*native)(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data);
+
+typedef enum {
+    FAKE_SYMBOL,
+    FAKE_INTEGER,
+    FAKE_STRING,
+    FAKE_CONS,
+    FAKE_VECTOR,
+    FAKE_USER_PTR,
+    FAKE_FUNCTION
+} fake_kind;
+
+/**
+ * A value. All values are linked together in allocation order, so that
+ * they can be collected. REFS is the number of global references to it.
+ */
+struct emacs_value_tag {
+    fake_kind kind;
+    int64_t refs;
+    struct emacs_value_tag *next;
+    union {
+        struct {
+            char *name;
+            emacs_value function;
+        } symbol;
+        intmax_t integer;
+        struct {
+            char *data;
+            ptrdiff_t length;
+        } string;
+        struct {
+            emacs_value car;
+            emacs_value cdr;
+        } cons;
+        struct {
+            emacs_value *items;
+            ptrdiff_t length;
+        } vector;
+        struct {
+            void (*fin)(void*);
+            void *ptr;
+        } user_ptr;
+        struct {
+            ptrdiff_t min_arity;
+            ptrdiff_t max_arity;
+            native function;
+            void *data;
+        } function;
+    } u;
+};
+
+/**
+ * An interned symbol, keyed by name.
+ */
+typedef struct {
+    emacs_value value;
+    UT_hash_handle hh;
+} interned;
+
+struct emacs_env_private {
+    enum emacs_funcall_exit exit;
+    emacs_value exit_symbol;
+    emacs_value exit_data;
+};
+
+/**
+ * The fake buffer. ASCII is true if every character is a single byte,
+ * so that positions don't need to be converted. Otherwise, like Emacs,
+ * the last converted position is remembered in CACHED_CHAR and CACHED_BYTE,
+ * and conversions scan from there.
+ */
+typedef struct {
+    char *data;
+    size_t nbytes;
+    intmax_t nchars;
+    bool ascii;
+    intmax_t cached_char;
+    size_t cached_byte;
+} fake_buffer;
+
+static struct emacs_env_private state = {emacs_funcall_exit_return, NULL, NULL};
+static emacs_env env_struct;
+static struct emacs_runtime runtime;
+static bool initialized = false;
+
+static emacs_value values = NULL;
+static interned *symbols = NULL;
+static uint64_t nvalues = 0;
+static fake_buffer buffer = {NULL, 0, 0, true, 1, 0};
+
+static emacs_value nil;
+static emacs_value type_symbols[FAKE_FUNCTION + 1];
+
+/**
+ * Duplicate a string or a byte array, adding a terminating null.
+ */
+static char *copy_bytes(const char *data, size_t nbytes)
+{
+    char *retval = (char*) ALLOC(nbytes + 1);
+    if (!retval)
+        abort();
+    memcpy(retval, data, nbytes);
+    retval[nbytes] = '\0';
+    return retval;
+}
+
+static emacs_value new_value(fake_kind kind)
+{
+    emacs_value retval = (emacs_value) ALLOC(sizeof(struct emacs_value_tag));
+    if (!retval)
+        abort();
+    retval->kind = kind;
+    retval->refs = 0;
+    retval->next = values;
+    values = retval;
+    nvalues++;
+    return retval;
+}
+
+static emacs_value intern(emacs_env *env, const char *name)
+{
+    interned *entry;
+    HASH_FIND_STR(symbols, name, entry);
+    if (entry)
+        return entry->value;
+
+    emacs_value symbol = new_value(FAKE_SYMBOL);
+    symbol->refs = 1;   // Symbols live forever
+    symbol->u.symbol.name = copy_bytes(name, strlen(name));
+    symbol->u.symbol.function = NULL;
+
+    entry = (interned*) ALLOC(sizeof(interned));
+    if (!entry)
+        abort();
+    entry->value = symbol;
+    HASH_ADD_KEYPTR(hh, symbols, symbol->u.symbol.name, strlen(name), entry);
+    return symbol;
+}
+
+static void signal_error(emacs_env *env, const char *symbol, emacs_value data);
+
+/**
+ * Make a list of one or two values, for error data.
+ */
+static emacs_value list2(emacs_value a, emacs_value b)
+{
+    emacs_value tail = nil;
+    if (b) {
+        tail = new_value(FAKE_CONS);
+        tail->u.cons.car = b;
+        tail->u.cons.cdr = nil;
+    }
+    emacs_value head = new_value(FAKE_CONS);
+    head->u.cons.car = a;
+    head->u.cons.cdr = tail;
+    return head;
+}
+
+/**
+ * Check the kind of a value, signaling wrong-type-argument otherwise.
+ */
+static bool check(emacs_env *env, emacs_value value, fake_kind kind, const char *predicate)
+{
+    if (value->kind == kind)
+        return true;
+    signal_error(env, "wrong-type-argument", list2(intern(env, predicate), value));
+    return false;
+}
+
+static emacs_value make_global_ref(emacs_env *env, emacs_value value)
+{
+    value->refs++;
+    return value;
+}
+
+static void free_global_ref(emacs_env *env, emacs_value value)
+{
+    value->refs--;
+}
+
+static enum emacs_funcall_exit non_local_exit_check(emacs_env *env)
+{
+    return env->private_members->exit;
+}
+
+static void non_local_exit_clear(emacs_env *env)
+{
+    env->private_members->exit = emacs_funcall_exit_return;
+}
+
+static enum emacs_funcall_exit non_local_exit_get(emacs_env *env, emacs_value *symbol, emacs_value *data)
+{
+    struct emacs_env_private *state = env->private_members;
+    if (state->exit != emacs_funcall_exit_return) {
+        *symbol = state->exit_symbol;
+        *data = state->exit_data;
+    }
+    return state->exit;
+}
+
+static void non_local_exit_signal(emacs_env *env, emacs_value symbol, emacs_value data)
+{
+    struct emacs_env_private *state = env->private_members;
+    if (state->exit != emacs_funcall_exit_return)
+        return;
+    state->exit = emacs_funcall_exit_signal;
+    state->exit_symbol = symbol;
+    state->exit_data = data;
+}
+
+static void non_local_exit_throw(emacs_env *env, emacs_value tag, emacs_value value)
+{
+    struct emacs_env_private *state = env->private_members;
+    if (state->exit != emacs_funcall_exit_return)
+        return;
+    state->exit = emacs_funcall_exit_throw;
+    state->exit_symbol = tag;
+    state->exit_data = value;
+}
+
+static void signal_error(emacs_env *env, const char *symbol, emacs_value data)
+{
+    non_local_exit_signal(env, intern(env, symbol), data);
+}
+
+static emacs_value make_function(emacs_env *env, ptrdiff_t min_arity, ptrdiff_t max_arity,
+                                 native function, const char *documentation, void *data)
+{
+    emacs_value retval = new_value(FAKE_FUNCTION);
+    retval->u.function.min_arity = min_arity;
+    retval->u.function.max_arity = max_arity;
+    retval->u.function.function = function;
+    retval->u.function.data = data;
+    return retval;
+}
+
+static emacs_value funcall(emacs_env *env, emacs_value function, ptrdiff_t nargs, emacs_value args[])
+{
+    if (env->private_members->exit != emacs_funcall_exit_return)
+        return nil;
+
+    emacs_value callee = function;
+    if (callee->kind == FAKE_SYMBOL)
+        callee = callee->u.symbol.function;
+    if (!callee || callee->kind != FAKE_FUNCTION) {
+        signal_error(env, "void-function", list2(function, NULL));
+        return nil;
+    }
+
+    ptrdiff_t max_arity = callee->u.function.max_arity;
+    if (nargs < callee->u.function.min_arity ||
+        (max_arity != emacs_variadic_function && nargs > max_arity)) {
+        signal_error(env, "wrong-number-of-arguments", list2(function, NULL));
+        return nil;
+    }
+    return callee->u.function.function(env, nargs, args, callee->u.function.data);
+}
+
+static emacs_value type_of(emacs_env *env, emacs_value value)
+{
+    return type_symbols[value->kind];
+}
+
+static bool is_not_nil(emacs_env *env, emacs_value value)
+{
+    return value != nil;
+}
+
+static bool eq(emacs_env *env, emacs_value a, emacs_value b)
+{
+    // Integers are fixnums in Emacs, so they are eq by value
+    if (a->kind == FAKE_INTEGER && b->kind == FAKE_INTEGER)
+        return a->u.integer == b->u.integer;
+    return a == b;
+}
+
+static intmax_t extract_integer(emacs_env *env, emacs_value value)
+{
+    if (!check(env, value, FAKE_INTEGER, "integerp"))
+        return 0;
+    return value->u.integer;
+}
+
+static emacs_value make_integer(emacs_env *env, intmax_t integer)
+{
+    emacs_value retval = new_value(FAKE_INTEGER);
+    retval->u.integer = integer;
+    return retval;
+}
+
+static double extract_float(emacs_env *env, emacs_value value)
+{
+    signal_error(env, "wrong-type-argument", list2(intern(env, "floatp"), value));
+    return 0;
+}
+
+static emacs_value make_float(emacs_env *env, double value)
+{
+    return make_integer(env, (intmax_t) value);
+}
+
+static bool copy_string_contents(emacs_env *env, emacs_value value, char *dest, ptrdiff_t *size)
+{
+    if (!check(env, value, FAKE_STRING, "stringp"))
+        return false;
+
+    ptrdiff_t needed = value->u.string.length + 1;
+    if (!dest) {
+        *size = needed;
+        return true;
+    }
+    if (*size < needed) {
+        *size = needed;
+        signal_error(env, "args-out-of-range", list2(value, NULL));
+        return false;
+    }
+    memcpy(dest, value->u.string.data, needed);
+    *size = needed;
+    return true;
+}
+
+static emacs_value make_string(emacs_env *env, const char *contents, ptrdiff_t length)
+{
+    emacs_value retval = new_value(FAKE_STRING);
+    retval->u.string.data = copy_bytes(contents, length);
+    retval->u.string.length = length;
+    return retval;
+}
+
+static emacs_value make_user_ptr(emacs_env *env, void (*fin)(void*), void *ptr)
+{
+    emacs_value retval = new_value(FAKE_USER_PTR);
+    retval->u.user_ptr.fin = fin;
+    retval->u.user_ptr.ptr = ptr;
+    return retval;
+}
+
+static void *get_user_ptr(emacs_env *env, emacs_value value)
+{
+    if (!check(env, value, FAKE_USER_PTR, "user-ptrp"))
+        return NULL;
+    return value->u.user_ptr.ptr;
+}
+
+static void set_user_ptr(emacs_env *env, emacs_value value, void *ptr)
+{
+    if (check(env, value, FAKE_USER_PTR, "user-ptrp"))
+        value->u.user_ptr.ptr = ptr;
+}
+
+static void (*get_user_finalizer(emacs_env *env, emacs_value value))(void*)
+{
+    if (!check(env, value, FAKE_USER_PTR, "user-ptrp"))
+        return NULL;
+    return value->u.user_ptr.fin;
+}
+
+static void set_user_finalizer(emacs_env *env, emacs_value value, void (*fin)(void*))
+{
+    if (check(env, value, FAKE_USER_PTR, "user-ptrp"))
+        value->u.user_ptr.fin = fin;
+}
+
+static emacs_value vec_get(emacs_env *env, emacs_value vec, ptrdiff_t i)
+{
+    if (!check(env, vec, FAKE_VECTOR, "vectorp"))
+        return nil;
+    if (i < 0 || i >= vec->u.vector.length) {
+        signal_error(env, "args-out-of-range", list2(vec, make_integer(env, i)));
+        return nil;
+    }
+    return vec->u.vector.items[i];
+}
+
+static void vec_set(emacs_env *env, emacs_value vec, ptrdiff_t i, emacs_value value)
+{
+    if (!check(env, vec, FAKE_VECTOR, "vectorp"))
+        return;
+    if (i < 0 || i >= vec->u.vector.length) {
+        signal_error(env, "args-out-of-range", list2(vec, make_integer(env, i)));
+        return;
+    }
+    vec->u.vector.items[i] = value;
+}
+
+static ptrdiff_t vec_size(emacs_env *env, emacs_value vec)
+{
+    if (!check(env, vec, FAKE_VECTOR, "vectorp"))
+        return 0;
+    return vec->u.vector.length;
+}
+
+static bool should_quit(emacs_env *env)
+{
+    return false;
+}
+
+/**
+ * Convert a one-based character position in the fake buffer to a byte offset.
+ */
+static size_t buffer_byte(intmax_t position)
+{
+    if (position < 1)
+        position = 1;
+    if (position > buffer.nchars + 1)
+        position = buffer.nchars + 1;
+    if (buffer.ascii)
+        return position - 1;
+
+    // Scan from the start of the buffer or from the cached position, whichever is closer
+    intmax_t chr = 1;
+    size_t byte = 0;
+    if (buffer.cached_char <= position ? position - buffer.cached_char < position - 1
+        : buffer.cached_char - position < position - 1) {
+        chr = buffer.cached_char;
+        byte = buffer.cached_byte;
+    }
+    for (; chr < position; chr++) {
+        byte++;
+        while (byte < buffer.nbytes && (buffer.data[byte] & 0xc0) == 0x80)
+            byte++;
+    }
+    for (; chr > position; chr--) {
+        byte--;
+        while (byte > 0 && (buffer.data[byte] & 0xc0) == 0x80)
+            byte--;
+    }
+    buffer.cached_char = position;
+    buffer.cached_byte = byte;
+    return byte;
+}
+
+/**
+ * Count the characters in some UTF-8 text.
+ */
+static intmax_t count_chars(const char *text, size_t nbytes, bool *ascii)
+{
+    intmax_t nchars = 0;
+    *ascii = true;
+    for (size_t i = 0; i < nbytes; i++) {
+        if ((text[i] & 0xc0) != 0x80)
+            nchars++;
+        if (text[i] & 0x80)
+            *ascii = false;
+    }
+    return nchars;
+}
+
+bool fake_buffer_set(const char *text, size_t nbytes)
+{
+    char *data = (char*) REALLOC(buffer.data, nbytes + 1);
+    if (!data)
+        return false;
+    memcpy(data, text, nbytes);
+    data[nbytes] = '\0';
+    buffer.data = data;
+    buffer.nbytes = nbytes;
+    buffer.nchars = count_chars(text, nbytes, &buffer.ascii);
+    buffer.cached_char = 1;
+    buffer.cached_byte = 0;
+    return true;
+}
+
+intmax_t fake_buffer_replace(intmax_t beg, intmax_t end, const char *text, size_t nbytes)
+{
+    if (beg > end)
+        return -1;
+    size_t start = buffer_byte(beg), stop = buffer_byte(end);
+    size_t new_nbytes = buffer.nbytes - (stop - start) + nbytes;
+
+    if (new_nbytes > buffer.nbytes) {
+        char *data = (char*) REALLOC(buffer.data, new_nbytes + 1);
+        if (!data)
+            return -1;
+        buffer.data = data;
+    }
+    memmove(buffer.data + start + nbytes, buffer.data + stop, buffer.nbytes - stop + 1);
+    memcpy(buffer.data + start, text, nbytes);
+
+    bool ascii;
+    intmax_t inserted = count_chars(text, nbytes, &ascii);
+    intmax_t old_nchars = buffer.nchars;
+    buffer.nbytes = new_nbytes;
+    buffer.nchars += inserted - (end - beg);
+    buffer.ascii = buffer.ascii && ascii;
+    // The text before the change didn't move
+    buffer.cached_char = beg < 1 ? 1 : beg > old_nchars + 1 ? old_nchars + 1 : beg;
+    buffer.cached_byte = start;
+    return inserted;
+}
+
+intmax_t fake_buffer_size(void)
+{
+    return buffer.nchars;
+}
+
+/**
+ * Fetch an integer argument of a native function, or signal an error.
+ */
+static bool integer_arg(emacs_env *env, emacs_value arg, intmax_t *integer)
+{
+    if (!check(env, arg, FAKE_INTEGER, "integer-or-marker-p"))
+        return false;
+    *integer = arg->u.integer;
+    return true;
+}
+
+static emacs_value f_cons(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    emacs_value retval = new_value(FAKE_CONS);
+    retval->u.cons.car = args[0];
+    retval->u.cons.cdr = args[1];
+    return retval;
+}
+
+static emacs_value f_car(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    if (args[0] == nil)
+        return nil;
+    if (!check(env, args[0], FAKE_CONS, "listp"))
+        return nil;
+    return args[0]->u.cons.car;
+}
+
+static emacs_value f_cdr(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    if (args[0] == nil)
+        return nil;
+    if (!check(env, args[0], FAKE_CONS, "listp"))
+        return nil;
+    return args[0]->u.cons.cdr;
+}
+
+static emacs_value f_list(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    emacs_value retval = nil;
+    for (ptrdiff_t i = nargs; i > 0; i--) {
+        emacs_value cell = new_value(FAKE_CONS);
+        cell->u.cons.car = args[i - 1];
+        cell->u.cons.cdr = retval;
+        retval = cell;
+    }
+    return retval;
+}
+
+static emacs_value f_vector(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    emacs_value retval = new_value(FAKE_VECTOR);
+    retval->u.vector.items = (emacs_value*) ALLOC((nargs + 1) * sizeof(emacs_value));
+    if (!retval->u.vector.items)
+        abort();
+    if (nargs > 0)
+        memcpy(retval->u.vector.items, args, nargs * sizeof(emacs_value));
+    retval->u.vector.length = nargs;
+    return retval;
+}
+
+static emacs_value f_defalias(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    if (!check(env, args[0], FAKE_SYMBOL, "symbolp"))
+        return nil;
+    // The function cell keeps the definition alive
+    args[0]->u.symbol.function = make_global_ref(env, args[1]);
+    return args[0];
+}
+
+static emacs_value f_provide(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    return args[0];
+}
+
+static emacs_value f_symbol_name(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    if (!check(env, args[0], FAKE_SYMBOL, "symbolp"))
+        return nil;
+    const char *name = args[0]->u.symbol.name;
+    return make_string(env, name, strlen(name));
+}
+
+static emacs_value f_buffer_size(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    return make_integer(env, buffer.nchars);
+}
+
+static emacs_value f_buffer_substring(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    intmax_t beg, end;
+    if (!integer_arg(env, args[0], &beg) || !integer_arg(env, args[1], &end))
+        return nil;
+    if (beg > end) {
+        intmax_t tmp = beg;
+        beg = end;
+        end = tmp;
+    }
+    if (beg < 1 || end > buffer.nchars + 1) {
+        signal_error(env, "args-out-of-range", list2(args[0], args[1]));
+        return nil;
+    }
+    size_t start = buffer_byte(beg), stop = buffer_byte(end);
+    return make_string(env, buffer.data + start, stop - start);
+}
+
+static emacs_value f_put_text_property(emacs_env *env, ptrdiff_t nargs, emacs_value args[], void *data)
+{
+    // Text properties are not stored, but the arguments are checked
+    intmax_t beg, end;
+    if (integer_arg(env, args[0], &beg))
+        integer_arg(env, args[1], &end);
+    return nil;
+}
+
+static void defnative(emacs_env *env, const char *name, ptrdiff_t min_arity, ptrdiff_t max_arity,
+                      native function)
+{
+    emacs_value symbol = intern(env, name);
+    emacs_value definition = make_function(env, min_arity, max_arity, function, NULL, NULL);
+    symbol->u.symbol.function = make_global_ref(env, definition);
+}
+
+static void init(void)
+{
+    env_struct.size = sizeof(env_struct);
+    env_struct.private_members = &state;
+    env_struct.make_global_ref = make_global_ref;
+    env_struct.free_global_ref = free_global_ref;
+    env_struct.non_local_exit_check = non_local_exit_check;
+    env_struct.non_local_exit_clear = non_local_exit_clear;
+    env_struct.non_local_exit_get = non_local_exit_get;
+    env_struct.non_local_exit_signal = non_local_exit_signal;
+    env_struct.non_local_exit_throw = non_local_exit_throw;
+    env_struct.make_function = make_function;
+    env_struct.funcall = funcall;
+    env_struct.intern = intern;
+    env_struct.type_of = type_of;
+    env_struct.is_not_nil = is_not_nil;
+    env_struct.eq = eq;
+    env_struct.extract_integer = extract_integer;
+    env_struct.make_integer = make_integer;
+    env_struct.extract_float = extract_float;
+    env_struct.make_float = make_float;
+    env_struct.copy_string_contents = copy_string_contents;
+    env_struct.make_string = make_string;
+    env_struct.make_user_ptr = make_user_ptr;
+    env_struct.get_user_ptr = get_user_ptr;
+    env_struct.set_user_ptr = set_user_ptr;
+    env_struct.get_user_finalizer = get_user_finalizer;
+    env_struct.set_user_finalizer = set_user_finalizer;
+    env_struct.vec_get = vec_get;
+    env_struct.vec_set = vec_set;
+    env_struct.vec_size = vec_size;
+    env_struct.should_quit = should_quit;
+
+    emacs_env *env = &env_struct;
+    nil = intern(env, "nil");
+    type_symbols[FAKE_SYMBOL] = intern(env, "symbol");
+    type_symbols[FAKE_INTEGER] = intern(env, "integer");
+    type_symbols[FAKE_STRING] = intern(env, "string");
+    type_symbols[FAKE_CONS] = intern(env, "cons");
+    type_symbols[FAKE_VECTOR] = intern(env, "vector");
+    type_symbols[FAKE_USER_PTR] = intern(env, "user-ptr");
+    type_symbols[FAKE_FUNCTION] = intern(env, "module-function");
+
+    defnative(env, "cons", 2, 2, f_cons);
+    defnative(env, "car", 1, 1, f_car);
+    defnative(env, "cdr", 1, 1, f_cdr);
+    defnative(env, "list", 0, emacs_variadic_function, f_list);
+    defnative(env, "vector", 0, emacs_variadic_function, f_vector);
+    defnative(env, "defalias", 2, 3, f_defalias);
+    defnative(env, "provide", 1, 2, f_provide);
+    defnative(env, "symbol-name", 1, 1, f_symbol_name);
+    defnative(env, "buffer-size", 0, 1, f_buffer_size);
+    defnative(env, "buffer-substring-no-properties", 2, 2, f_buffer_substring);
+    defnative(env, "put-text-property", 4, 5, f_put_text_property);
+
+    buffer.data = copy_bytes("", 0);
+    initialized = true;
+}
+
+emacs_env *fake_env_get(void)
+{
+    if (!initialized)
+        init();
+    return &env_struct;
+}
+
+static emacs_env *get_environment(struct emacs_runtime *ert)
+{
+    return fake_env_get();
+}
+
+struct emacs_runtime *fake_env_runtime(void)
+{
+    runtime.size = sizeof(runtime);
+    runtime.private_members = NULL;
+    runtime.get_environment = get_environment;
+    return &runtime;
+}
+
+/**
+ * Print a value, roughly like prin1.
+ */
+static void print_value(FILE *out, emacs_value value)
+{
+    switch (value->kind) {
+    case FAKE_SYMBOL:
+        fputs(value->u.symbol.name, out);
+        break;
+    case FAKE_INTEGER:
+        fprintf(out, "%jd", value->u.integer);
+        break;
+    case FAKE_STRING:
+        fprintf(out, "\"%.*s\"", (int) value->u.string.length, value->u.string.data);
+        break;
+    case FAKE_CONS:
+        fputc('(', out);
+        for (;;) {
+            print_value(out, value->u.cons.car);
+            value = value->u.cons.cdr;
+            if (value == nil)
+                break;
+            if (value->kind != FAKE_CONS) {
+                fputs(" . ", out);
+                print_value(out, value);
+                break;
+            }
+            fputc(' ', out);
+        }
+        fputc(')', out);
+        break;
+    case FAKE_VECTOR:
+        fputc('[', out);
+        for (ptrdiff_t i = 0; i < value->u.vector.length; i++) {
+            if (i > 0)
+                fputc(' ', out);
+            print_value(out, value->u.vector.items[i]);
+        }
+        fputc(']', out);
+        break;
+    case FAKE_USER_PTR:
+        fprintf(out, "#<user-ptr %p>", value->u.user_ptr.ptr);
+        break;
+    case FAKE_FUNCTION:
+        fputs("#<module function>", out);
+        break;
+    }
+}
+
+bool fake_env_failed(emacs_env *env, FILE *out)
+{
+    struct emacs_env_private *state = env->private_members;
+    if (state->exit == emacs_funcall_exit_return)
+        return false;
+
+    if (out) {
+        fputs(state->exit == emacs_funcall_exit_signal ? "signal: " : "throw: ", out);
+        print_value(out, state->exit_symbol);
+        fputc(' ', out);
+        print_value(out, state->exit_data);
+        fputc('\n', out);
+    }
+    state->exit = emacs_funcall_exit_return;
+    return true;
+}
+
+void fake_env_collect(emacs_env *env)
+{
+    // A pending error may refer to any value
+    fake_env_failed(env, NULL);
+
+    emacs_value *link = &values;
+    while (*link) {
+        emacs_value value = *link;
+        if (value->refs > 0) {
+            link = &value->next;
+            continue;
+        }
+
+        *link = value->next;
+        if (value->kind == FAKE_STRING)
+            free(value->u.string.data);
+        else if (value->kind == FAKE_VECTOR)
+            free(value->u.vector.items);
+        else if (value->kind == FAKE_USER_PTR && value->u.user_ptr.fin)
+            value->u.user_ptr.fin(value->u.user_ptr.ptr);
+        free(value);
+    }
+}
+
+uint64_t fake_env_values(void)
+{
+    return nvalues;
+}
+
+bool fake_env_allocs(uint64_t *count)
+{
+#ifdef YEAST_BENCH_WRAP_MALLOC
+    *count = __atomic_load_n(&allocs, __ATOMIC_RELAXED);
+    return true;
+#else
+    *count = 0;
+    return false;
+#endif
+}
@@ -0,0 +1,88 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "emacs-module.h"
+
+#ifndef FAKE_ENV_H
+#define FAKE_ENV_H
+
+/**
+ * A native stand-in for the Emacs module environment, implementing just
+ * enough of it for libyeast to run without Emacs.
+ *
+ * Values are allocated on the heap and never freed until fake_env_collect,
+ * which frees every value not held by a global reference and runs the
+ * finalizers of user pointers. Global references don't keep other values
+ * alive, so they should only be taken on symbols and user pointers.
+ *
+ * The functions libyeast calls through funcall (cons, car, vector,
+ * buffer-substring-no-properties, defalias, ...) are implemented natively,
+ * over a single fake buffer.
+ */
+
+/**
+ * Get the runtime to pass to emacs_module_init.
+ * @return The runtime.
+ */
+struct emacs_runtime *fake_env_runtime(void);
+
+/**
+ * Get the environment. The environment is created on first use.
+ * @return The environment.
+ */
+emacs_env *fake_env_get(void);
+
+/**
+ * Check for a pending non-local exit, and clear it.
+ * @param env The environment.
+ * @param out Where to print the error, or NULL.
+ * @return True iff there was a non-local exit.
+ */
+bool fake_env_failed(emacs_env *env, FILE *out);
+
+/**
+ * Free all values that are not held by global references.
+ * @param env The environment.
+ */
+void fake_env_collect(emacs_env *env);
+
+/**
+ * Get the number of values created so far.
+ * @return The number of values.
+ */
+uint64_t fake_env_values(void);
+
+/**
+ * Get the number of native memory allocations so far, outside the environment.
+ * @param count Output parameter for the number of allocations.
+ * @return False if allocations are not counted in this build.
+ */
+bool fake_env_allocs(uint64_t *count);
+
+/**
+ * Replace the contents of the fake buffer.
+ * @param text The new contents, in UTF-8.
+ * @param nbytes The length of TEXT in bytes.
+ * @return False if out of memory.
+ */
+bool fake_buffer_set(const char *text, size_t nbytes);
+
+/**
+ * Replace a region of the fake buffer, like Emacs would before running
+ * after-change-functions.
+ * @param beg The start of the region (one-based character position).
+ * @param end The end of the region.
+ * @param text The replacement, in UTF-8.
+ * @param nbytes The length of TEXT in bytes.
+ * @return The number of characters in TEXT, or -1 on failure.
+ */
+intmax_t fake_buffer_replace(intmax_t beg, intmax_t end, const char *text, size_t nbytes);
+
+/**
+ * Get the size of the fake buffer in characters.
+ * @return The size.
+ */
+intmax_t fake_buffer_size(void);
+
+#endif /* FAKE_ENV_H */
@@ -0,0 +1,69 @@
+;;; highlight.el --- Time full-buffer highlighting for each grammar. -*- lexical-binding: t; -*-
+
+;;; Commentary:
+
+;; Run from the repository root, after building the module:
+;;
+;;   emacs -Q --batch -l bench/highlight.el
+;;
+;; For each built-in grammar, a buffer is filled with copies of a small
+;; sample, parsed, and highlighted in full with the default patterns.
+
+;;; Code:
+
+(load-file (expand-file-name "yeast.el"))
+
+(defvar yeast-bench-size (* 256 1024)
+  "Approximate size in bytes of each buffer to highlight.")
+
+(defvar yeast-bench-runs 5
+  "Number of times to highlight each buffer.")
+
+(defvar yeast-bench-samples
+  '((bash . "# comment\nfor f in *.txt; do\n  echo \"file $f\" > /dev/null\ndone\n")
+    (c . "/* comment */\nint f(int x) { return x * 42 + 'a'; }\nchar *s = \"string\";\n")
+    (cpp . "// comment\nclass A { public: int f() const { return 42; } };\nauto s = \"string\";\n")
+    (css . "/* comment */\n.class > p { color: #ff0000; margin: 10px 2em; }\n")
+    (go . "// comment\nfunc f(x int) string { if x > 42 { return \"big\" }; return `small` }\n")
+    (html . "<!-- comment -->\n<div class=\"box\"><p id=\"x\">Hello <b>world</b></p></div>\n")
+    (javascript . "// comment\nfunction f(x) { const s = `t${x}`; return x * 42 + \"str\"; }\n")
+    (json . "{\"key\": [1, 2.5, \"string\", true, false, null], \"nested\": {\"a\": 42}},\n")
+    (ocaml . "(* comment *)\nlet rec f x = if x > 42 then \"big\" else f (x + 1)\n")
+    (php . "<?php // comment\nfunction f($x) { return $x * 42 . \"string\"; } ?>\n")
+    (python . "# comment\ndef f(x):\n    return x * 42 + len(\"string\")\n")
+    (ruby . "# comment\ndef f(x)\n  x * 42 + \"string\".length\nend\n")
+    (rust . "// comment\nfn f(x: i32) -> String { if x > 42 { \"big\".into() } else { format!(\"{}\", x) } }\n")
+    (typescript . "// comment\nfunction f(x: number): string { return `${x * 42}` + \"str\"; }\n"))
+  "Sample code for each language.")
+
+(defun yeast-bench--fill (language sample)
+  "Fill the current buffer with copies of SAMPLE, in LANGUAGE."
+  (let ((copies (max 1 (/ yeast-bench-size (string-bytes sample)))))
+    ;; Keep JSON well-formed
+    (when (eq language 'json)
+      (insert "["))
+    (dotimes (_ copies)
+      (insert sample))
+    (when (eq language 'json)
+      (insert "{}]"))))
+
+(dolist (entry yeast-bench-samples)
+  (let ((language (car entry)))
+    (with-temp-buffer
+      (yeast-bench--fill language (cdr entry))
+      (let* ((instance (yeast--make-instance language))
+             (_ (yeast--parse instance))
+             (tree (yeast--instance-tree instance))
+             (query (yeast--highlight-query language))
+             (runs nil)
+             (result (benchmark-run yeast-bench-runs
+                       (with-silent-modifications
+                         (setq runs (yeast--highlight tree query (point-min) (point-max)))
+                         (yeast--apply-faces (point-min) (point-max) runs)))))
+        ;; One call for the region, then one put-text-property per run
+        (princ (format "%-12s %8d bytes %8.2f ms/run %8d runs %8d put-text-property\n"
+                       language (buffer-size)
+                       (/ (* 1000 (- (car result) (nth 2 result))) yeast-bench-runs)
+                       (/ (length runs) 3) (1+ (/ (length runs) 3))))))))
+
+;;; highlight.el ends here
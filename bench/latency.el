@@ -0,0 +1,157 @@
+;;; latency.el --- Time yeast-mode's work per change in scripted edit sessions. -*- lexical-binding: t; -*-
+
+;;; Commentary:
+
+;; Run from the repository root, after building the module:
+;;
+;;   emacs -Q --batch -l bench/latency.el
+;;
+;; For each file size, a buffer is filled with generated Python code and
+;; `yeast-mode' is turned on.  Then each session replays its edits, one
+;; change at a time, like a user would make them: typing a line, pasting
+;; blocks, deleting large regions and answering `query-replace'.
+;;
+;; The time of a change is that of the change itself, which runs
+;; `yeast--after-change', plus getting the tree afterwards, which is what
+;; the next redisplay or command would do.  The parse is synchronous, as
+;; timers don't run in batch mode.
+;;
+;; Positions are drawn from a fixed seed, and the heap is collected before
+;; each session, so two runs on the same build make the same changes.
+
+;;; Code:
+
+(require 'cl-lib)
+
+(load-file (expand-file-name "yeast.el"))
+
+(defvar yeast-bench-sizes '((small . 4096)
+                            (medium . 262144)
+                            (huge . 8388608))
+  "Names and approximate sizes in bytes of the files to edit.")
+
+(defvar yeast-bench-sessions '(typing pasting deleting query-replace)
+  "Sessions to replay on each file.")
+
+(defvar yeast-bench-seed "yeast-bench"
+  "Seed of the random positions, so that runs are repeatable.")
+
+(defvar yeast-bench-typed "    result = compute(value, 42)  # typed\n"
+  "The text of the typing session, inserted one character at a time.")
+
+(defvar yeast-bench-pastes 20
+  "Number of blocks inserted by the pasting session.")
+
+(defvar yeast-bench-deletions 10
+  "Number of regions removed by the deleting session.")
+
+(defvar yeast-bench-replacements 200
+  "Most replacements answered by the query-replace session.")
+
+(defvar yeast-bench--samples nil
+  "Times of the changes of the current session, in seconds.")
+
+(defun yeast-bench--function (i)
+  "Return the source of a generated Python function, numbered I."
+  (format "def f%d(x, y=%d):
+    \"\"\"Docstring of f%d.\"\"\"
+    if x > y:
+        return [x * %d for _ in range(y)]
+    return {\"x\": x, \"y\": y, \"s\": 'f%d'}
+
+" i i i i i))
+
+(defun yeast-bench--source (size)
+  "Return about SIZE bytes of Python code."
+  (let ((functions nil)
+        (length 0)
+        (i 0))
+    (while (< length size)
+      (let ((function (yeast-bench--function i)))
+        (push function functions)
+        (setq length (+ length (string-bytes function))
+              i (1+ i))))
+    (apply #'concat (nreverse functions))))
+
+(defun yeast-bench--line-start ()
+  "Move to the start of a random line."
+  (goto-char (1+ (random (buffer-size))))
+  (forward-line 0))
+
+(defmacro yeast-bench--change (&rest body)
+  "Run BODY, which makes a change, and time it until the tree is up to date."
+  `(let ((start (float-time)))
+     ,@body
+     (yeast--instance-tree yeast--instance)
+     (push (- (float-time) start) yeast-bench--samples)))
+
+(defun yeast-bench--typing ()
+  "Type a line, one character at a time."
+  (yeast-bench--line-start)
+  (dolist (char (string-to-list yeast-bench-typed))
+    (yeast-bench--change (insert char))))
+
+(defun yeast-bench--pasting ()
+  "Paste blocks of a few functions at random lines."
+  (let ((block (mapconcat #'yeast-bench--function (number-sequence 0 9) "")))
+    (dotimes (_ yeast-bench-pastes)
+      (yeast-bench--line-start)
+      (yeast-bench--change (insert block)))))
+
+(defun yeast-bench--deleting ()
+  "Delete regions of a twentieth of the buffer, between random lines."
+  (dotimes (_ yeast-bench-deletions)
+    (yeast-bench--line-start)
+    (let ((beg (point)))
+      (forward-line (max 1 (/ (count-lines (point-min) (point-max)) 20)))
+      (yeast-bench--change (delete-region beg (point))))))
+
+(defun yeast-bench--query-replace ()
+  "Replace occurrences of a word one by one, as if answering `query-replace'."
+  (goto-char (point-min))
+  (let ((case-fold-search nil)
+        (count 0))
+    (while (and (< count yeast-bench-replacements)
+                (search-forward "return" nil t))
+      (yeast-bench--change (replace-match "yield" t t))
+      (setq count (1+ count)))))
+
+(defun yeast-bench--percentile (samples p)
+  "Return the Pth percentile of SAMPLES, a sorted vector."
+  (aref samples (floor (* p (1- (length samples))))))
+
+(defun yeast-bench--run (source session)
+  "Replay SESSION on a buffer holding SOURCE, and return its statistics.
+The result is (CHANGES P50 P99 MAX GCS GC-ELAPSED), with times in seconds."
+  (with-temp-buffer
+    (insert source)
+    ;; Turn on the mode in fundamental-mode, so that only yeast is measured
+    (cl-letf (((symbol-function 'yeast-detect-language) (lambda () 'python)))
+      (yeast-mode 1))
+    (random yeast-bench-seed)
+    (setq yeast-bench--samples nil)
+    (garbage-collect)
+    (let ((gcs gcs-done)
+          (gc-time gc-elapsed))
+      (funcall (intern (format "yeast-bench--%s" session)))
+      (let ((samples (vconcat (sort yeast-bench--samples #'<))))
+        (prog1 (list (length samples)
+                     (yeast-bench--percentile samples 0.5)
+                     (yeast-bench--percentile samples 0.99)
+                     (aref samples (1- (length samples)))
+                     (- gcs-done gcs)
+                     (- gc-elapsed gc-time))
+          (yeast-mode -1))))))
+
+(princ (format "%-7s %9s %-14s %7s %9s %9s %9s %4s %9s\n"
+               "file" "bytes" "session" "changes" "p50 ms" "p99 ms" "max ms" "GCs" "GC ms"))
+(dolist (size yeast-bench-sizes)
+  (let ((source (yeast-bench--source (cdr size))))
+    (dolist (session yeast-bench-sessions)
+      (pcase-let ((`(,changes ,p50 ,p99 ,max ,gcs ,gc-time)
+                   (yeast-bench--run source session)))
+        (princ (format "%-7s %9d %-14s %7d %9.3f %9.3f %9.3f %4d %9.1f\n"
+                       (car size) (string-bytes source) session changes
+                       (* 1000 p50) (* 1000 p99) (* 1000 max) gcs (* 1000 gc-time)))))))
+
+;;; latency.el ends here
@@ -0,0 +1,71 @@
+;;; parsers.el --- Measure parser memory for many buffers. -*- lexical-binding: t; -*-
+
+;;; Commentary:
+
+;; Run from the repository root, after building the module:
+;;
+;;   emacs -Q --batch -l bench/parsers.el
+;;
+;; Opens 500 buffers with a yeast instance each, parses them all, and
+;; reports the growth of the resident set size and the number of parsers
+;; alive.
+;;
+;; Before parser pools, every instance kept its own parser. To compare
+;; with that design in the same build, each buffer is then edited and
+;; re-parsed with a budget of one microsecond, which suspends the parse and
+;; leaves each instance holding a parser, and the RSS is measured again.
+;; A suspended parser also holds the state of its parse, so the difference
+;; slightly overstates the memory saved.
+
+;;; Code:
+
+(load-file (expand-file-name "yeast.el"))
+
+(defvar yeast-bench-buffers 500
+  "Number of buffers to open.")
+
+(defun yeast-bench--rss ()
+  "Get the resident set size of this process in kilobytes, from /proc."
+  (with-temp-buffer
+    (insert-file-contents "/proc/self/status")
+    (when (re-search-forward "^VmRSS:[ \t]*\\([0-9]+\\)" nil t)
+      (string-to-number (match-string 1)))))
+
+(defun yeast-bench--parsers-live ()
+  "Get the number of parsers alive."
+  (plist-get (yeast--parser-stats) :live))
+
+(let ((source (mapconcat (lambda (i) (format "def f%d(x):\n    return x * %d\n\n" i i))
+                         (number-sequence 1 50) ""))
+      (before (progn (garbage-collect) (yeast-bench--rss)))
+      buffers)
+  (dotimes (i yeast-bench-buffers)
+    (let ((buffer (generate-new-buffer (format "yeast-bench-%d" i))))
+      (with-current-buffer buffer
+        (insert source)
+        (setq-local yeast--instance (yeast--make-instance 'python))
+        (yeast--parse yeast--instance))
+      (push buffer buffers)))
+  (garbage-collect)
+  (let* ((pooled (- (yeast-bench--rss) before))
+         (pooled-parsers (yeast-bench--parsers-live)))
+    ;; Hold a parser in every instance, like before pools
+    (dolist (buffer buffers)
+      (with-current-buffer buffer
+        (goto-char (point-min))
+        (insert "#")
+        (yeast--edit yeast--instance 1 2 0)
+        (yeast--parse-step yeast--instance 1)))
+    (garbage-collect)
+    (let* ((held (- (yeast-bench--rss) before))
+           (held-parsers (yeast-bench--parsers-live))
+           (extra (- held-parsers pooled-parsers)))
+      (princ (format "%d buffers with parser pools: RSS grew by %d kB, %d parsers live\n"
+                     yeast-bench-buffers pooled pooled-parsers))
+      (princ (format "%d buffers with a parser each: RSS grew by %d kB, %d parsers live\n"
+                     yeast-bench-buffers held held-parsers))
+      (princ (format "saved by pools: %d kB (%.1f kB per parser)\n"
+                     (- held pooled)
+                     (if (> extra 0) (/ (float (- held pooled)) extra) 0.0))))))
+
+;;; parsers.el ends here
@@ -0,0 +1,367 @@
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "emacs-module.h"
+
+#include "fake-env.h"
+
+/**
+ * Benchmark libyeast without Emacs, through a native module environment.
+ *
+ * For each language, a buffer is filled with a corpus, and the following
+ * are measured through the functions libyeast defines for Emacs:
+ *   parse     a full parse of the buffer with yeast--parse
+ *   edit      yeast--edit and yeast--flush after inserting or deleting a
+ *             character at a random position (the change itself isn't timed)
+ *   traverse  a preorder walk of the tree with a cursor
+ *   types     the same walk, calling yeast--cursor-type on each node
+ *
+ * Each result is printed on its own line as a JSON object.
+ */
+
+#define USAGE "usage: yeast-bench [-c CORPUS] [-s SIZE] [-n RUNS] [-e EDITS] [LANGUAGE...]\n"
+
+static const char *samples[][2] = {
+    {"bash", "# comment\nfor f in *.txt; do\n  echo \"file $f\" > /dev/null\ndone\n"},
+    {"c", "/* comment */\nint f(int x) { return x * 42 + 'a'; }\nchar *s = \"string\";\n"},
+    {"cpp", "// comment\nclass A { public: int f() const { return 42; } };\nauto s = \"string\";\n"},
+    {"css", "/* comment */\n.class > p { color: #ff0000; margin: 10px 2em; }\n"},
+    {"go", "// comment\nfunc f(x int) string { if x > 42 { return \"big\" }; return `small` }\n"},
+    {"html", "<!-- comment -->\n<div class=\"box\"><p id=\"x\">Hello <b>world</b></p></div>\n"},
+    {"javascript", "// comment\nfunction f(x) { const s = `t${x}`; return x * 42 + \"str\"; }\n"},
+    {"json", "{\"key\": [1, 2.5, \"string\", true, false, null], \"nested\": {\"a\": 42}},\n"},
+    {"ocaml", "(* comment *)\nlet rec f x = if x > 42 then \"big\" else f (x + 1)\n"},
+    {"php", "<?php // comment\nfunction f($x) { return $x * 42 . \"string\"; } ?>\n"},
+    {"python", "# comment\ndef f(x):\n    return x * 42 + len(\"string\")\n"},
+    {"ruby", "# comment\ndef f(x)\n  x * 42 + \"string\".length\nend\n"},
+    {"rust", "// comment\nfn f(x: i32) -> String { if x > 42 { \"big\".into() } else { format!(\"{}\", x) } }\n"},
+    {"typescript", "// comment\nfunction f(x: number): string { return `${x * 42}` + \"str\"; }\n"},
+};
+
+#define NSAMPLES (sizeof(samples) / sizeof(samples[0]))
+
+typedef struct {
+    const char *corpus;
+    size_t size;
+    int runs;
+    int edits;
+} options;
+
+/**
+ * Counters at the start of a measurement.
+ */
+typedef struct {
+    struct timespec time;
+    uint64_t values;
+    uint64_t allocs;
+} mark;
+
+static emacs_env *env;
+
+// Functions of libyeast, interned once
+static emacs_value f_make_instance, f_parse, f_edit, f_flush, f_instance_tree, f_tree_root,
+    f_cursor_new, f_cursor_goto_first_child, f_cursor_goto_next_sibling, f_cursor_goto_parent,
+    f_cursor_type;
+
+static emacs_value call(emacs_value function, ptrdiff_t nargs, emacs_value *args)
+{
+    return env->funcall(env, function, nargs, args);
+}
+
+static emacs_value call1(emacs_value function, emacs_value arg)
+{
+    return call(function, 1, &arg);
+}
+
+static mark start(void)
+{
+    mark retval;
+    fake_env_allocs(&retval.allocs);
+    retval.values = fake_env_values();
+    clock_gettime(CLOCK_MONOTONIC, &retval.time);
+    return retval;
+}
+
+/**
+ * Leave out of a measurement started at FROM what happened since PAUSED,
+ * such as the work of the fake environment itself.
+ */
+static void skip(mark *from, mark paused)
+{
+    mark now = start();
+    from->values += now.values - paused.values;
+    from->allocs += now.allocs - paused.allocs;
+    int64_t ns = (int64_t) (now.time.tv_sec - paused.time.tv_sec) * 1000000000
+        + (now.time.tv_nsec - paused.time.tv_nsec) + from->time.tv_nsec;
+    from->time.tv_sec += ns / 1000000000;
+    from->time.tv_nsec = ns % 1000000000;
+}
+
+/**
+ * Print the result of a measurement started at MARK, over OPS operations.
+ */
+static void report(const char *language, const char *benchmark, mark from, uint64_t ops, size_t bytes)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    uint64_t values = fake_env_values();
+    uint64_t allocs;
+    bool counted = fake_env_allocs(&allocs);
+
+    double ns = (now.tv_sec - from.time.tv_sec) * 1e9 + (now.tv_nsec - from.time.tv_nsec);
+    if (ops == 0)
+        ops = 1;
+    printf("{\"language\": \"%s\", \"benchmark\": \"%s\", \"bytes\": %zu, \"ops\": %llu, "
+           "\"ns_per_op\": %.1f, \"values_per_op\": %.2f, \"allocs_per_op\": ",
+           language, benchmark, bytes, (unsigned long long) ops,
+           ns / ops, (double) (values - from.values) / ops);
+    if (counted)
+        printf("%.2f}\n", (double) (allocs - from.allocs) / ops);
+    else
+        printf("null}\n");
+    fflush(stdout);
+}
+
+static int visible(const struct dirent *entry)
+{
+    return entry->d_name[0] != '.';
+}
+
+// Byte order, unlike alphasort, doesn't depend on the locale
+static int by_name(const struct dirent **a, const struct dirent **b)
+{
+    return strcmp((*a)->d_name, (*b)->d_name);
+}
+
+/**
+ * Read every regular file in DIR into a single buffer.
+ * The files are sorted by name, so that the corpus is the same on every machine.
+ */
+static char *read_corpus(const char *dir, size_t *nbytes)
+{
+    struct dirent **entries;
+    int nentries = scandir(dir, &entries, visible, by_name);
+    if (nentries < 0)
+        return NULL;
+
+    char *data = NULL;
+    size_t length = 0;
+    bool ok = true;
+    for (int i = 0; ok && i < nentries; i++) {
+        struct dirent *entry = entries[i];
+        char path[strlen(dir) + strlen(entry->d_name) + 2];
+        sprintf(path, "%s/%s", dir, entry->d_name);
+        FILE *file = fopen(path, "rb");
+        if (!file)
+            continue;
+        char chunk[65536];
+        size_t n;
+        while ((n = fread(chunk, 1, sizeof(chunk), file)) > 0) {
+            char *grown = (char*) realloc(data, length + n);
+            if (!grown) {
+                ok = false;
+                break;
+            }
+            data = grown;
+            memcpy(data + length, chunk, n);
+            length += n;
+        }
+        fclose(file);
+    }
+    for (int i = 0; i < nentries; i++)
+        free(entries[i]);
+    free(entries);
+
+    if (!ok) {
+        free(data);
+        return NULL;
+    }
+    *nbytes = length;
+    return data;
+}
+
+/**
+ * Build the text for a language: its corpus if there is one, or copies of its sample.
+ */
+static char *make_text(const options *opts, const char *language, const char *sample, size_t *nbytes)
+{
+    if (opts->corpus) {
+        char dir[strlen(opts->corpus) + strlen(language) + 2];
+        sprintf(dir, "%s/%s", opts->corpus, language);
+        char *text = read_corpus(dir, nbytes);
+        if (text)
+            return text;
+    }
+
+    size_t sample_length = strlen(sample);
+    size_t copies = opts->size / sample_length;
+    if (copies == 0)
+        copies = 1;
+    bool json = strcmp(language, "json") == 0;
+    char *text = (char*) malloc(copies * sample_length + 4);
+    if (!text)
+        return NULL;
+
+    // Keep JSON well-formed
+    size_t length = 0;
+    if (json)
+        text[length++] = '[';
+    for (size_t i = 0; i < copies; i++, length += sample_length)
+        memcpy(text + length, sample, sample_length);
+    if (json) {
+        memcpy(text + length, "{}]", 3);
+        length += 3;
+    }
+    *nbytes = length;
+    return text;
+}
+
+/**
+ * Walk a tree in preorder with a cursor, optionally getting the type of each node.
+ * @return The number of nodes visited.
+ */
+static uint64_t walk(emacs_value tree, bool types)
+{
+    emacs_value cursor = call1(f_cursor_new, call1(f_tree_root, tree));
+    uint64_t nodes = 0;
+    for (;;) {
+        nodes++;
+        if (types)
+            call1(f_cursor_type, cursor);
+        if (env->is_not_nil(env, call1(f_cursor_goto_first_child, cursor)))
+            continue;
+        while (!env->is_not_nil(env, call1(f_cursor_goto_next_sibling, cursor)))
+            if (!env->is_not_nil(env, call1(f_cursor_goto_parent, cursor)))
+                return nodes;
+    }
+}
+
+/**
+ * Run all benchmarks for one language.
+ * @return False if a benchmark failed.
+ */
+static bool bench_language(const options *opts, const char *language, const char *sample)
+{
+    size_t nbytes;
+    char *text = make_text(opts, language, sample, &nbytes);
+    if (!text || !fake_buffer_set(text, nbytes)) {
+        fprintf(stderr, "%s: could not build the text\n", language);
+        free(text);
+        return false;
+    }
+    free(text);
+
+    emacs_value instance = call1(f_make_instance, env->intern(env, language));
+    if (fake_env_failed(env, stderr))
+        return false;
+    instance = env->make_global_ref(env, instance);
+    bool ok = false;
+
+    mark from = start();
+    for (int i = 0; i < opts->runs; i++)
+        call1(f_parse, instance);
+    report(language, "parse", from, opts->runs, nbytes);
+    if (fake_env_failed(env, stderr))
+        goto done;
+    fake_env_collect(env);
+
+    // Alternately insert and delete a character at pseudo-random positions.
+    // Only yeast--edit and yeast--flush are timed, not the fake buffer.
+    uint64_t seed = 42;
+    from = start();
+    for (int i = 0; i < opts->edits; i++) {
+        mark paused = start();
+        seed = seed * 6364136223846793005ULL + 1442695040888963407ULL;
+        bool insert = i % 2 == 0 || fake_buffer_size() == 0;
+        intmax_t pos = 1 + (intmax_t) ((seed >> 33) % (uint64_t) (fake_buffer_size() + insert));
+        if (insert)
+            fake_buffer_replace(pos, pos, " ", 1);
+        else
+            fake_buffer_replace(pos, pos + 1, "", 0);
+        skip(&from, paused);
+        emacs_value args[] = {
+            instance,
+            env->make_integer(env, pos),
+            env->make_integer(env, insert ? pos + 1 : pos),
+            env->make_integer(env, insert ? 0 : 1)
+        };
+        call(f_edit, 4, args);
+        call1(f_flush, instance);
+    }
+    report(language, "edit", from, opts->edits, nbytes);
+    if (fake_env_failed(env, stderr))
+        goto done;
+    fake_env_collect(env);
+
+    emacs_value tree = env->make_global_ref(env, call1(f_instance_tree, instance));
+    uint64_t nodes = 0;
+    from = start();
+    for (int i = 0; i < opts->runs; i++)
+        nodes += walk(tree, false);
+    report(language, "traverse", from, nodes, nbytes);
+    fake_env_collect(env);
+
+    nodes = 0;
+    from = start();
+    for (int i = 0; i < opts->runs; i++)
+        nodes += walk(tree, true);
+    report(language, "types", from, nodes, nbytes);
+    env->free_global_ref(env, tree);
+    ok = !fake_env_failed(env, stderr);
+
+done:
+    env->free_global_ref(env, instance);
+    fake_env_collect(env);
+    return ok;
+}
+
+int emacs_module_init(struct emacs_runtime *ert);
+
+int main(int argc, char **argv)
+{
+    options opts = {NULL, 256 * 1024, 5, 1000};
+    int opt;
+    while ((opt = getopt(argc, argv, "c:s:n:e:h")) != -1) {
+        switch (opt) {
+        case 'c': opts.corpus = optarg; break;
+        case 's': opts.size = strtoul(optarg, NULL, 10); break;
+        case 'n': opts.runs = atoi(optarg); break;
+        case 'e': opts.edits = atoi(optarg); break;
+        default:
+            fputs(USAGE, stderr);
+            return opt == 'h' ? 0 : 2;
+        }
+    }
+
+    emacs_module_init(fake_env_runtime());
+    env = fake_env_get();
+    if (fake_env_failed(env, stderr))
+        return 1;
+
+    f_make_instance = env->intern(env, "yeast--make-instance");
+    f_parse = env->intern(env, "yeast--parse");
+    f_edit = env->intern(env, "yeast--edit");
+    f_flush = env->intern(env, "yeast--flush");
+    f_instance_tree = env->intern(env, "yeast--instance-tree");
+    f_tree_root = env->intern(env, "yeast--tree-root");
+    f_cursor_new = env->intern(env, "yeast--cursor-new");
+    f_cursor_goto_first_child = env->intern(env, "yeast--cursor-goto-first-child");
+    f_cursor_goto_next_sibling = env->intern(env, "yeast--cursor-goto-next-sibling");
+    f_cursor_goto_parent = env->intern(env, "yeast--cursor-goto-parent");
+    f_cursor_type = env->intern(env, "yeast--cursor-type");
+
+    int failures = 0;
+    for (size_t i = 0; i < NSAMPLES; i++) {
+        const char *language = samples[i][0];
+        bool wanted = optind == argc;
+        for (int j = optind; j < argc; j++)
+            wanted = wanted || strcmp(argv[j], language) == 0;
+        if (wanted && !bench_language(&opts, language, samples[i][1]))
+            failures++;
+    }
+    return failures > 0;
+}
@@ -11,57 +11,56 @@
 // We store some global references to emacs objects, mostly symbols,
 // so that we don't have to waste time calling intern later on.
 emacs_value em_nil, em_t;
+emacs_value em_byte, em_named;
 emacs_value em_integerp, em_stringp, em_symbolp;
-emacs_value em_yeast_instance_p, em_yeast_tree_p, em_yeast_node_p;
+
+// Types, as returned by type-of
+emacs_value em_integer, em_string, em_symbol, em_user_ptr;
+emacs_value em_yeast_instance_p, em_yeast_tree_p, em_yeast_node_p, em_yeast_cursor_p,
+    em_yeast_query_p;
 
 // Error symbols
 emacs_value em_unknown_language;
 
-// Supported languages
-emacs_value em_bash, em_c, em_cpp, em_css, em_go, em_html, em_javascript,
-    em_json, em_ocaml, em_php, em_python, em_ruby, em_rust, em_typescript;
-
 // Symbols that are only reachable from within this file.
-static emacs_value _buffer_size, _buffer_substring, _cons, _defalias,
-    _error, _provide, _user_ptrp, _wrong_type_argument;
+static emacs_value _buffer_size, _buffer_substring_no_properties, _car, _cdr, _cons, _defalias,
+    _error, _list, _provide, _symbol_name, _vector, _wrong_type_argument;
 
 void em_init(emacs_env *env)
 {
     em_nil = GLOBREF(INTERN("nil"));
     em_t = GLOBREF(INTERN("t"));
+    em_byte = GLOBREF(INTERN("byte"));
+    em_named = GLOBREF(INTERN("named"));
 
     em_integerp = GLOBREF(INTERN("integerp"));
     em_stringp = GLOBREF(INTERN("stringp"));
     em_symbolp = GLOBREF(INTERN("symbolp"));
 
+    em_integer = GLOBREF(INTERN("integer"));
+    em_string = GLOBREF(INTERN("string"));
+    em_symbol = GLOBREF(INTERN("symbol"));
+    em_user_ptr = GLOBREF(INTERN("user-ptr"));
+
     em_yeast_instance_p = GLOBREF(INTERN("yeast-instance-p"));
     em_yeast_tree_p = GLOBREF(INTERN("yeast-tree-p"));
     em_yeast_node_p = GLOBREF(INTERN("yeast-node-p"));
+    em_yeast_cursor_p = GLOBREF(INTERN("yeast-cursor-p"));
+    em_yeast_query_p = GLOBREF(INTERN("yeast-query-p"));
 
     em_unknown_language = GLOBREF(INTERN("unknown-language"));
 
-    em_bash = GLOBREF(INTERN("bash"));
-    em_c = GLOBREF(INTERN("c"));
-    em_cpp = GLOBREF(INTERN("cpp"));
-    em_css = GLOBREF(INTERN("css"));
-    em_go = GLOBREF(INTERN("go"));
-    em_html = GLOBREF(INTERN("html"));
-    em_javascript = GLOBREF(INTERN("javascript"));
-    em_json = GLOBREF(INTERN("json"));
-    em_ocaml = GLOBREF(INTERN("ocaml"));
-    em_php = GLOBREF(INTERN("php"));
-    em_python = GLOBREF(INTERN("python"));
-    em_ruby = GLOBREF(INTERN("ruby"));
-    em_rust = GLOBREF(INTERN("rust"));
-    em_typescript = GLOBREF(INTERN("typescript"));
-
     _buffer_size = GLOBREF(INTERN("buffer-size"));
-    _buffer_substring = GLOBREF(INTERN("buffer-substring"));
+    _buffer_substring_no_properties = GLOBREF(INTERN("buffer-substring-no-properties"));
+    _car = GLOBREF(INTERN("car"));
+    _cdr = GLOBREF(INTERN("cdr"));
     _cons = GLOBREF(INTERN("cons"));
     _defalias = GLOBREF(INTERN("defalias"));
     _error = GLOBREF(INTERN("error"));
+    _list = GLOBREF(INTERN("list"));
     _provide = GLOBREF(INTERN("provide"));
-    _user_ptrp = GLOBREF(INTERN("user-ptrp"));
+    _symbol_name = GLOBREF(INTERN("symbol-name"));
+    _vector = GLOBREF(INTERN("vector"));
     _wrong_type_argument = GLOBREF(INTERN("wrong-type-argument"));
 }
 
@@ -85,9 +84,9 @@ static emacs_value em_funcall(emacs_env *env, emacs_value func, ptrdiff_t nargs,
     return env->funcall(env, func, nargs, args);
 }
 
-bool em_assert_type(emacs_env *env, emacs_value predicate, emacs_value arg)
+bool em_assert_type(emacs_env *env, emacs_value type, emacs_value predicate, emacs_value arg)
 {
-    bool cond = env->is_not_nil(env, em_funcall(env, predicate, 1, arg));
+    bool cond = env->eq(env, env->type_of(env, arg), type);
     if (!cond)
         em_signal_wrong_type(env, predicate, arg);
     return cond;
@@ -122,6 +121,37 @@ emacs_value em_cons(emacs_env *env, emacs_value car, emacs_value cdr)
     return em_funcall(env, _cons, 2, car, cdr);
 }
 
+emacs_value em_car(emacs_env *env, emacs_value cell)
+{
+    return em_funcall(env, _car, 1, cell);
+}
+
+emacs_value em_cdr(emacs_env *env, emacs_value cell)
+{
+    return em_funcall(env, _cdr, 1, cell);
+}
+
+bool em_consp(emacs_env *env, emacs_value val)
+{
+    // The type of a cons cell is the symbol cons
+    return env->eq(env, env->type_of(env, val), _cons);
+}
+
+char *em_symbol_name(emacs_env *env, emacs_value symbol)
+{
+    return em_get_string(env, em_funcall(env, _symbol_name, 1, symbol));
+}
+
+emacs_value em_list(emacs_env *env, ptrdiff_t nargs, emacs_value *args)
+{
+    return env->funcall(env, _list, nargs, args);
+}
+
+emacs_value em_vector(emacs_env *env, ptrdiff_t nargs, emacs_value *args)
+{
+    return env->funcall(env, _vector, nargs, args);
+}
+
 void em_defun(emacs_env *env, const char *name, emacs_value func)
 {
     em_funcall(env, _defalias, 2, INTERN(name), func);
@@ -132,23 +162,17 @@ uint32_t em_buffer_size(emacs_env *env)
     return env->extract_integer(env, em_funcall(env, _buffer_size, 0));
 }
 
-bool em_buffer_contents(emacs_env *env, uint32_t offset, uint32_t nchars, char *buffer)
+emacs_value em_buffer_substring(emacs_env *env, intmax_t beg, intmax_t end, ptrdiff_t *nbytes)
 {
     emacs_value string = em_funcall(
-        env, _buffer_substring, 2,
-        env->make_integer(env, offset + 1),
-        env->make_integer(env, offset + nchars + 1)
+        env, _buffer_substring_no_properties, 2,
+        env->make_integer(env, beg),
+        env->make_integer(env, end)
     );
 
-    // Check that we got what we asked for
-    ptrdiff_t nbytes;
-    env->copy_string_contents(env, string, NULL, &nbytes);
-
-    if (nbytes - 1 != nchars)
-        return false;
-
-    env->copy_string_contents(env, string, buffer, &nbytes);
-    return true;
+    *nbytes = 0;
+    env->copy_string_contents(env, string, NULL, nbytes);
+    return string;
 }
 
 void em_provide(emacs_env *env, const char *feature)
@@ -158,5 +182,5 @@ void em_provide(emacs_env *env, const char *feature)
 
 bool em_user_ptrp(emacs_env *env, emacs_value val)
 {
-    return env->is_not_nil(env, em_funcall(env, _user_ptrp, 1, val));
+    return env->eq(env, env->type_of(env, val), em_user_ptr);
 }
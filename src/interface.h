@@ -6,14 +6,14 @@
 #define INTERFACE_H
 
 extern emacs_value em_nil, em_t;
+extern emacs_value em_byte, em_named;
 extern emacs_value em_integerp, em_stringp, em_symbolp;
-extern emacs_value em_yeast_instance_p, em_yeast_tree_p, em_yeast_node_p;
+extern emacs_value em_integer, em_string, em_symbol, em_user_ptr;
+extern emacs_value em_yeast_instance_p, em_yeast_tree_p, em_yeast_node_p, em_yeast_cursor_p,
+    em_yeast_query_p;
 
 extern emacs_value em_unknown_language;
 
-extern emacs_value em_bash, em_c, em_cpp, em_css, em_go, em_html, em_javascript,
-    em_json, em_ocaml, em_php, em_python, em_ruby, em_rust, em_typescript;
-
 /**
  * Initialize the libyeast-emacs interface.
  * This function should only be called once.
@@ -21,13 +21,15 @@ extern emacs_value em_bash, em_c, em_cpp, em_css, em_go, em_html, em_javascript,
 void em_init(emacs_env *env);
 
 /**
- * Signal a wrong-type-argument error if PREDICATE does not apply to ARG.
+ * Signal a wrong-type-argument error if the type of ARG is not TYPE.
+ * This uses type-of, so it never calls back into Lisp.
  * @param env The active Emacs environment.
- * @param predicate The predicate.
+ * @param type The expected type, as returned by type-of.
+ * @param predicate The predicate to report in the error.
  * @param arg The argument.
- * @return True iff an error was signaled.
+ * @return True iff ARG has the right type.
  */
-bool em_assert_type(emacs_env *env, emacs_value predicate, emacs_value arg);
+bool em_assert_type(emacs_env *env, emacs_value type, emacs_value predicate, emacs_value arg);
 
 /**
  * Signal a generic error with string message.
@@ -62,6 +64,57 @@ char *em_get_string(emacs_env *env, emacs_value arg);
  */
 emacs_value em_cons(emacs_env *env, emacs_value car, emacs_value cdr);
 
+/**
+ * Call (car cell) in Emacs.
+ * @param env The active Emacs environment.
+ * @param cell The cons cell.
+ * @return The car.
+ */
+emacs_value em_car(emacs_env *env, emacs_value cell);
+
+/**
+ * Call (cdr cell) in Emacs.
+ * @param env The active Emacs environment.
+ * @param cell The cons cell.
+ * @return The cdr.
+ */
+emacs_value em_cdr(emacs_env *env, emacs_value cell);
+
+/**
+ * Check if a value is a cons cell.
+ * @param env The active Emacs environment.
+ * @param val Value to check.
+ * @return True iff val is a cons cell.
+ */
+bool em_consp(emacs_env *env, emacs_value val);
+
+/**
+ * Return the name of a symbol.
+ * Caller is responsible for ensuring that the value is a symbol, and to free the returned pointer.
+ * @param env The active Emacs environment.
+ * @param symbol Emacs value representing a symbol.
+ * @return The name (owned pointer).
+ */
+char *em_symbol_name(emacs_env *env, emacs_value symbol);
+
+/**
+ * Call (list args...) in Emacs.
+ * @param env The active Emacs environment.
+ * @param nargs The number of elements.
+ * @param args The elements.
+ * @return The list.
+ */
+emacs_value em_list(emacs_env *env, ptrdiff_t nargs, emacs_value *args);
+
+/**
+ * Call (vector args...) in Emacs.
+ * @param env The active Emacs environment.
+ * @param nargs The number of elements.
+ * @param args The elements.
+ * @return The vector.
+ */
+emacs_value em_vector(emacs_env *env, ptrdiff_t nargs, emacs_value *args);
+
 /**
  * Define a function in Emacs, using defalias.
  * @param env The active Emacs environment.
@@ -76,17 +129,15 @@ void em_defun(emacs_env *env, const char *name, emacs_value func);
 uint32_t em_buffer_size(emacs_env *env);
 
 /**
- * Copy Emacs buffer contents to a buffer.
- * Caller is responsible that the Emacs buffer contains as many characters as asked for,
- * and that the buffer can hold that many.
- * Note: the Emacs buffer should probably be in unibyte mode!
+ * Call (buffer-substring-no-properties beg end) in Emacs.
  * @param env The active Emacs environment.
- * @param offset The starting offset to read from.
- * @param nchars The number of characters to read.
- * @param buffer The buffer to write into.
- * @return True if ok, false if not ok.
+ * @param beg The starting position.
+ * @param end The ending position.
+ * @param nbytes Output parameter for the size of the string when encoded as UTF-8,
+ *        including the terminating null.
+ * @return The string.
  */
-bool em_buffer_contents(emacs_env *env, uint32_t offset, uint32_t nchars, char *buffer);
+emacs_value em_buffer_substring(emacs_env *env, intmax_t beg, intmax_t end, ptrdiff_t *nbytes);
 
 /**
  * Provide a feature to Emacs.
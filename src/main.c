@@ -25,6 +25,9 @@ int emacs_module_init(struct emacs_runtime *ert)
     // Initialize our own interface to Emacs
     em_init(env);
 
+    // Register the built-in languages, without loading them
+    yeast_language_init();
+
     // Define all lisp-callable functions
     yeast_init(env);
 
@@ -0,0 +1,316 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "tree_sitter/runtime.h"
+
+#include "interface.h"
+#include "yeast.h"
+#include "yeast-batch.h"
+#include "yeast-cache.h"
+#include "yeast-instance.h"
+#include "yeast-query.h"
+#include "yeast-traversal.h"
+
+/**
+ * The files not yet taken from a worker, as a range of indices.
+ * The owner takes files from the front, other workers steal from the back.
+ */
+typedef struct {
+    pthread_mutex_t lock;
+    uint32_t front;
+    uint32_t back;
+} deque;
+
+/**
+ * The result for one file. Without a query, the parsed INSTANCE is kept
+ * for the main thread to wrap in a tree. With a query, CAPTURES holds its
+ * results, with byte offsets already converted to character offsets.
+ */
+typedef struct {
+    bool ok;
+    yeast_instance *instance;
+    yeast_query_results captures;
+} result;
+
+typedef struct {
+    yeast_language *language;
+    const yeast_query *query;
+    const yeast_cache *cache;
+    char **paths;
+    result *results;
+    deque *deques;
+    uint32_t nworkers;
+} batch;
+
+/**
+ * A worker of a batch, and its thread if STARTED.
+ */
+typedef struct {
+    batch *batch;
+    uint32_t index;
+    pthread_t thread;
+    bool started;
+} worker;
+
+/**
+ * Take the next file from a deque, from the front or the back.
+ * @return False if the deque is empty.
+ */
+static bool take(deque *deque, bool front, uint32_t *file)
+{
+    pthread_mutex_lock(&deque->lock);
+    bool found = deque->front < deque->back;
+    if (found)
+        *file = front ? deque->front++ : --deque->back;
+    pthread_mutex_unlock(&deque->lock);
+    return found;
+}
+
+/**
+ * Take the next file for a worker, stealing one from another worker if
+ * it has none left.
+ * @return False if no files are left at all.
+ */
+static bool next_file(batch *batch, uint32_t index, uint32_t *file)
+{
+    if (take(&batch->deques[index], true, file))
+        return true;
+    for (uint32_t i = 1; i < batch->nworkers; i++)
+        if (take(&batch->deques[(index + i) % batch->nworkers], false, file))
+            return true;
+    return false;
+}
+
+/**
+ * Parse a file, and run the query of the batch over it if there is one.
+ * With a cache, the query results are looked up there first.
+ */
+static void process(batch *batch, uint32_t file, TSParser *parser)
+{
+    result *result = &batch->results[file];
+    yeast_text text;
+    if (!yeast_text_map(&text, batch->paths[file]))
+        return;
+
+    uint64_t hash = 0;
+    uint32_t length = yeast_text_length(&text);
+    if (batch->cache) {
+        hash = yeast_cache_hash(&text);
+        if (yeast_cache_lookup(batch->cache, hash, length, &result->captures)) {
+            yeast_text_free(&text);
+            result->ok = true;
+            return;
+        }
+    }
+
+    yeast_instance *instance = yeast_instance_from_text(batch->language, &text, parser);
+    if (!instance)
+        return;
+
+    if (!batch->query) {
+        // The tree goes to Lisp, where a truncated file would cause SIGBUS
+        if (!yeast_text_unmap(&instance->text)) {
+            yeast_finalize(instance);
+            return;
+        }
+        result->instance = instance;
+        result->ok = true;
+        return;
+    }
+
+    TSNode root = ts_tree_root_node(instance->tree);
+    yeast_query_results *captures = &result->captures;
+    result->ok = yeast_query_exec(batch->query, root, 0, UINT32_MAX, captures);
+    for (size_t i = 0; result->ok && i < captures->length; i += 4) {
+        captures->data[i + 2] = yeast_instance_position(instance, captures->data[i + 2]) - 1;
+        captures->data[i + 3] = yeast_instance_position(instance, captures->data[i + 3]) - 1;
+    }
+    yeast_finalize(instance);
+
+    if (batch->cache && result->ok)
+        yeast_cache_store(batch->cache, hash, length, captures);
+}
+
+/**
+ * Thread entry point for a worker, which keeps one parser for all its files.
+ */
+static void *run_worker(void *_worker)
+{
+    worker *self = (worker*) _worker;
+    batch *batch = self->batch;
+
+    TSParser *parser = yeast_language_acquire(batch->language);
+    if (!parser)
+        return NULL;
+
+    uint32_t file;
+    while (next_file(batch, self->index, &file))
+        process(batch, file, parser);
+
+    yeast_language_release(batch->language, parser);
+    return NULL;
+}
+
+/**
+ * Parse files on a pool of worker threads, and wait for all of them.
+ * The files are dealt out to the workers in contiguous runs, and workers
+ * that run out steal from the others. The calling thread is worker zero,
+ * so the batch finishes even if no thread can be started.
+ * @param workers One worker per deque of the batch, allocated by the caller.
+ */
+static void run_batch(batch *batch, worker *workers, uint32_t nfiles)
+{
+    uint32_t n = batch->nworkers;
+    for (uint32_t i = 0; i < n; i++) {
+        deque *deque = &batch->deques[i];
+        pthread_mutex_init(&deque->lock, NULL);
+        deque->front = (uint64_t) nfiles * i / n;
+        deque->back = (uint64_t) nfiles * (i + 1) / n;
+        workers[i].batch = batch;
+        workers[i].index = i;
+    }
+
+    for (uint32_t i = 1; i < n; i++)
+        workers[i].started = pthread_create(&workers[i].thread, NULL, run_worker, &workers[i]) == 0;
+    run_worker(&workers[0]);
+
+    for (uint32_t i = 1; i < n; i++)
+        if (workers[i].started)
+            pthread_join(workers[i].thread, NULL);
+    for (uint32_t i = 0; i < n; i++)
+        pthread_mutex_destroy(&batch->deques[i].lock);
+}
+
+/**
+ * Convert the result for a file to an Emacs value.
+ */
+static emacs_value result_value(emacs_env *env, result *result, bool query)
+{
+    if (!result->ok)
+        return em_nil;
+    if (!query) {
+        // The tree holds the only reference to the instance
+        emacs_value retval = yeast_instance_snapshot(env, result->instance);
+        yeast_finalize(result->instance);
+        return retval;
+    }
+
+    yeast_query_results *captures = &result->captures;
+    emacs_value *values = (emacs_value*) malloc((captures->length + 1) * sizeof(emacs_value));
+    if (!values) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    for (size_t i = 0; i < captures->length; i += 4) {
+        values[i] = env->make_integer(env, captures->data[i]);
+        values[i + 1] = env->make_integer(env, captures->data[i + 1]);
+        values[i + 2] = env->make_integer(env, (intmax_t) captures->data[i + 2] + 1);
+        values[i + 3] = env->make_integer(env, (intmax_t) captures->data[i + 3] + 1);
+    }
+    emacs_value retval = em_vector(env, captures->length, values);
+    free(values);
+    return retval;
+}
+
+YEAST_DOC(parse_files, "LANGUAGE FILES &optional QUERY THREADS CACHE",
+          "Parse the list of FILES as LANGUAGE on a pool of native threads.\n\n"
+          "Return a vector with the result for each file, or nil for files that\n"
+          "could not be parsed. Without QUERY, the result is the tree of the\n"
+          "file, as returned by `yeast--parse-file'. With QUERY, it is the vector\n"
+          "returned by `yeast--query-run' on the root node of the tree, and the\n"
+          "tree itself is discarded. THREADS is the number of threads to use,\n"
+          "by default and at most the number of processors online.\n\n"
+          "With QUERY, CACHE may be a directory where the results are cached\n"
+          "by file contents, language and grammar version, and query. Entries\n"
+          "for other versions of the grammar are deleted. See `yeast--cache-trim'\n"
+          "to limit the size of the cache.");
+emacs_value yeast_parse_files(emacs_env *env, emacs_value _language, emacs_value _files,
+                              emacs_value _query, emacs_value _threads, emacs_value _cache)
+{
+    YEAST_ASSERT_SYMBOL(_language);
+    yeast_query *query = NULL;
+    if (YEAST_EXTRACT_BOOLEAN(_query)) {
+        YEAST_ASSERT_QUERY(_query);
+        query = YEAST_EXTRACT_QUERY(_query);
+    }
+    intmax_t nprocessors = sysconf(_SC_NPROCESSORS_ONLN);
+    intmax_t nthreads = nprocessors;
+    if (YEAST_EXTRACT_BOOLEAN(_threads)) {
+        YEAST_ASSERT_INTEGER(_threads);
+        nthreads = YEAST_EXTRACT_INTEGER(_threads);
+    }
+    if (YEAST_EXTRACT_BOOLEAN(_cache))
+        YEAST_ASSERT_STRING(_cache);
+
+    yeast_language *language = yeast_language_find(env, _language);
+    if (!language)
+        return em_nil;
+    if (query && query->language != language) {
+        em_signal_error(env, "query and files have different languages");
+        return em_nil;
+    }
+
+    // Check the file names before allocating anything
+    uint32_t nfiles = 0;
+    for (emacs_value cell = _files; em_consp(env, cell); cell = em_cdr(env, cell)) {
+        YEAST_ASSERT_STRING(em_car(env, cell));
+        nfiles++;
+    }
+    if (nfiles == 0)
+        return em_vector(env, 0, NULL);
+    // More threads than processors would only add contention on the pools
+    if (nthreads > nprocessors)
+        nthreads = nprocessors;
+    if (nthreads > nfiles)
+        nthreads = nfiles;
+    if (nthreads < 1)
+        nthreads = 1;
+
+    char **paths = (char**) calloc(nfiles, sizeof(char*));
+    result *results = (result*) calloc(nfiles, sizeof(result));
+    deque *deques = (deque*) calloc(nthreads, sizeof(deque));
+    worker *workers = (worker*) calloc(nthreads, sizeof(worker));
+    emacs_value *values = (emacs_value*) malloc(nfiles * sizeof(emacs_value));
+    if (!paths || !results || !deques || !workers || !values) {
+        free(paths);
+        free(results);
+        free(deques);
+        free(workers);
+        free(values);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+
+    emacs_value cell = _files;
+    for (uint32_t i = 0; i < nfiles; i++, cell = em_cdr(env, cell))
+        paths[i] = YEAST_EXTRACT_STRING(em_car(env, cell));
+
+    // Without a usable cache directory, everything is parsed
+    yeast_cache cache;
+    bool cached = false;
+    if (query && YEAST_EXTRACT_BOOLEAN(_cache)) {
+        char *root = YEAST_EXTRACT_STRING(_cache);
+        cached = yeast_cache_open(&cache, root, language, query);
+        free(root);
+    }
+
+    batch batch = {language, query, cached ? &cache : NULL, paths, results, deques, nthreads};
+    run_batch(&batch, workers, nfiles);
+    if (cached)
+        yeast_cache_close(&cache);
+
+    for (uint32_t i = 0; i < nfiles; i++) {
+        values[i] = result_value(env, &results[i], query != NULL);
+        free(results[i].captures.data);
+        free(paths[i]);
+    }
+    emacs_value retval = em_vector(env, nfiles, values);
+
+    free(paths);
+    free(results);
+    free(deques);
+    free(workers);
+    free(values);
+    return retval;
+}
@@ -0,0 +1,9 @@
+#include "yeast.h"
+
+#ifndef YEAST_BATCH_H
+#define YEAST_BATCH_H
+
+YEAST_DEFUN(parse_files, emacs_value _language, emacs_value _files, emacs_value _query, emacs_value _threads,
+            emacs_value _cache);
+
+#endif /* YEAST_BATCH_H */
@@ -0,0 +1,420 @@
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "tree_sitter/runtime.h"
+
+#include "interface.h"
+#include "yeast.h"
+#include "yeast-cache.h"
+
+// Bumped whenever the format of entries changes
+#define MAGIC "yeast\0\0\1"
+
+#define FNV_OFFSET 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+
+// Lengths of the names of grammar directories and entries
+#define GRAMMAR_NAME 16
+#define ENTRY_NAME 32
+
+// Age in seconds after which a temporary file is left over from a writer that
+// died before renaming it, rather than still being written
+#define TMP_GRACE 3600
+
+/**
+ * Header of a cache entry, followed by COUNT query results.
+ */
+typedef struct {
+    char magic[8];
+    uint64_t hash;
+    uint64_t query;
+    uint32_t length;
+    uint32_t count;
+} header;
+
+/**
+ * Continue a FNV-1a hash with some bytes.
+ */
+static uint64_t fnv(uint64_t hash, const void *data, size_t nbytes)
+{
+    const unsigned char *bytes = (const unsigned char*) data;
+    for (size_t i = 0; i < nbytes; i++) {
+        hash ^= bytes[i];
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+/**
+ * Fingerprint a grammar by its symbol table and the shared object it comes from,
+ * so that rebuilding it invalidates the cache.
+ */
+static uint64_t grammar_fingerprint(yeast_language *language)
+{
+    const TSLanguage *ts_language = language->language;
+    uint64_t hash = FNV_OFFSET;
+    uint32_t version = ts_language_version(ts_language);
+    uint32_t nsymbols = ts_language_symbol_count(ts_language);
+    hash = fnv(hash, &version, sizeof(version));
+    hash = fnv(hash, &nsymbols, sizeof(nsymbols));
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        const char *name = ts_language_symbol_name(ts_language, (TSSymbol) i);
+        TSSymbolType type = ts_language_symbol_type(ts_language, (TSSymbol) i);
+        hash = fnv(hash, name, strlen(name) + 1);
+        hash = fnv(hash, &type, sizeof(type));
+    }
+
+    struct stat st;
+    if (language->path && stat(language->path, &st) == 0) {
+        int64_t size = st.st_size, mtime = st.st_mtime;
+        hash = fnv(hash, &size, sizeof(size));
+        hash = fnv(hash, &mtime, sizeof(mtime));
+    }
+    return hash;
+}
+
+/**
+ * Fingerprint a compiled query.
+ */
+static uint64_t query_fingerprint(const yeast_query *query)
+{
+    uint64_t hash = FNV_OFFSET;
+    uint32_t nwords = (query->nsymbols + 63) / 64;
+    hash = fnv(hash, &query->npatterns, sizeof(query->npatterns));
+    hash = fnv(hash, query->patterns, query->npatterns * sizeof(uint32_t));
+    for (uint32_t i = 0; i < query->nsteps; i++) {
+        const yeast_query_step *step = &query->steps[i];
+        bool wildcard = !step->symbols;
+        hash = fnv(hash, &wildcard, sizeof(wildcard));
+        if (!wildcard)
+            hash = fnv(hash, step->symbols, nwords * sizeof(uint64_t));
+        hash = fnv(hash, &step->error, sizeof(step->error));
+        hash = fnv(hash, &step->end, sizeof(step->end));
+        hash = fnv(hash, &step->capture, sizeof(step->capture));
+    }
+    for (uint32_t i = 0; i < query->ncaptures; i++)
+        hash = fnv(hash, query->captures[i], strlen(query->captures[i]) + 1);
+    return hash;
+}
+
+/**
+ * Check that a name consists of a given number of lowercase hex digits.
+ */
+static bool hex_name(const char *name, size_t length)
+{
+    if (strlen(name) != length)
+        return false;
+    for (size_t i = 0; i < length; i++)
+        if (!((name[i] >= '0' && name[i] <= '9') || (name[i] >= 'a' && name[i] <= 'f')))
+            return false;
+    return true;
+}
+
+/**
+ * Create a directory and its parents.
+ */
+static bool make_dirs(char *path)
+{
+    for (char *p = path + 1; *p; p++) {
+        if (*p != '/')
+            continue;
+        *p = '\0';
+        int error = mkdir(path, 0777) < 0 && errno != EEXIST;
+        *p = '/';
+        if (error)
+            return false;
+    }
+    return mkdir(path, 0777) == 0 || errno == EEXIST;
+}
+
+/**
+ * Delete the entries of a grammar directory, and the directory itself if
+ * nothing else is left in it. Only names written by the cache are deleted.
+ */
+static void remove_grammar(const char *dir)
+{
+    DIR *handle = opendir(dir);
+    if (!handle)
+        return;
+
+    struct dirent *entry;
+    while ((entry = readdir(handle))) {
+        if (!hex_name(entry->d_name, ENTRY_NAME) && strncmp(entry->d_name, "tmp-", 4) != 0)
+            continue;
+        char path[strlen(dir) + strlen(entry->d_name) + 2];
+        sprintf(path, "%s/%s", dir, entry->d_name);
+        unlink(path);
+    }
+    closedir(handle);
+    rmdir(dir);
+}
+
+bool yeast_cache_open(yeast_cache *cache, const char *root,
+                      yeast_language *language, const yeast_query *query)
+{
+    size_t length = strlen(root) + strlen(language->name) + GRAMMAR_NAME + 3;
+    char *dir = (char*) malloc(length);
+    if (!dir)
+        return false;
+
+    uint64_t grammar = grammar_fingerprint(language);
+    sprintf(dir, "%s/%s/%016" PRIx64, root, language->name, grammar);
+    if (!make_dirs(dir)) {
+        free(dir);
+        return false;
+    }
+
+    // Entries for any other grammar are stale
+    char *name = strrchr(dir, '/');
+    *name = '\0';
+    DIR *handle = opendir(dir);
+    struct dirent *entry;
+    while (handle && (entry = readdir(handle))) {
+        if (!hex_name(entry->d_name, GRAMMAR_NAME) || strcmp(entry->d_name, name + 1) == 0)
+            continue;
+        char path[strlen(dir) + GRAMMAR_NAME + 2];
+        sprintf(path, "%s/%s", dir, entry->d_name);
+        remove_grammar(path);
+    }
+    if (handle)
+        closedir(handle);
+    *name = '/';
+
+    cache->dir = dir;
+    cache->query = query_fingerprint(query);
+    return true;
+}
+
+void yeast_cache_close(yeast_cache *cache)
+{
+    free(cache->dir);
+    cache->dir = NULL;
+}
+
+uint64_t yeast_cache_hash(const yeast_text *text)
+{
+    uint64_t hash = FNV_OFFSET;
+    uint32_t offset = 0, nbytes;
+    const char *chunk;
+    while ((chunk = yeast_text_chunk(text, offset, &nbytes)), nbytes > 0) {
+        hash = fnv(hash, chunk, nbytes);
+        offset += nbytes;
+    }
+    return hash;
+}
+
+/**
+ * Get the path of the entry for a text.
+ * PATH must have room for the directory, a slash, the name and a null.
+ */
+static void entry_path(const yeast_cache *cache, uint64_t hash, char *path)
+{
+    sprintf(path, "%s/%016" PRIx64 "%016" PRIx64, cache->dir, hash, cache->query);
+}
+
+bool yeast_cache_lookup(const yeast_cache *cache, uint64_t hash, uint32_t length,
+                        yeast_query_results *results)
+{
+    char path[strlen(cache->dir) + ENTRY_NAME + 2];
+    entry_path(cache, hash, path);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(header)) {
+        close(fd);
+        return false;
+    }
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (data == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    const header *head = (const header*) data;
+    bool found = memcmp(head->magic, MAGIC, sizeof(head->magic)) == 0 &&
+        head->hash == hash && head->query == cache->query && head->length == length &&
+        head->count % 4 == 0 &&
+        (uint64_t) st.st_size == sizeof(header) + (uint64_t) head->count * sizeof(uint32_t);
+    if (found && head->count > 0) {
+        results->data = (uint32_t*) malloc(head->count * sizeof(uint32_t));
+        found = results->data != NULL;
+        if (found) {
+            memcpy(results->data, head + 1, head->count * sizeof(uint32_t));
+            results->length = results->capacity = head->count;
+        }
+    }
+
+    // Mark the entry as recently used, for yeast_cache_evict
+    if (found)
+        futimens(fd, NULL);
+    munmap(data, st.st_size);
+    close(fd);
+    return found;
+}
+
+void yeast_cache_store(const yeast_cache *cache, uint64_t hash, uint32_t length,
+                       const yeast_query_results *results)
+{
+    if (results->length > UINT32_MAX)
+        return;
+
+    char path[strlen(cache->dir) + ENTRY_NAME + 2];
+    sprintf(path, "%s/tmp-XXXXXX", cache->dir);
+    int fd = mkstemp(path);
+    if (fd < 0)
+        return;
+
+    header head = {MAGIC, hash, cache->query, length, (uint32_t) results->length};
+    size_t nbytes = results->length * sizeof(uint32_t);
+    bool ok = write(fd, &head, sizeof(head)) == sizeof(head) &&
+        (nbytes == 0 || write(fd, results->data, nbytes) == (ssize_t) nbytes);
+    ok = close(fd) == 0 && ok;
+
+    // Readers only ever see complete entries
+    char tmp[sizeof(path)];
+    strcpy(tmp, path);
+    entry_path(cache, hash, path);
+    if (!ok || rename(tmp, path) < 0)
+        unlink(tmp);
+}
+
+/**
+ * An entry found while trimming a cache.
+ */
+typedef struct {
+    char *path;
+    uint64_t size;
+    int64_t mtime;
+} entry;
+
+typedef struct {
+    entry *data;
+    size_t length;
+    size_t capacity;
+} entry_list;
+
+static int compare_entries(const void *_a, const void *_b)
+{
+    const entry *a = (const entry*) _a, *b = (const entry*) _b;
+    return (a->mtime > b->mtime) - (a->mtime < b->mtime);
+}
+
+/**
+ * Add the entries in a directory to a list, along with left over temporary
+ * files, which are given the oldest possible time so that they go first.
+ * With LEVEL above zero, recurse into subdirectories instead: language
+ * directories at level 2, grammar directories at level 1.
+ */
+static bool collect(const char *dir, int level, entry_list *entries)
+{
+    DIR *handle = opendir(dir);
+    if (!handle)
+        return false;
+
+    bool ok = true;
+    struct dirent *dirent;
+    while (ok && (dirent = readdir(handle))) {
+        const char *name = dirent->d_name;
+        if (name[0] == '.')
+            continue;
+        if (level == 1 && !hex_name(name, GRAMMAR_NAME))
+            continue;
+        bool tmp = strncmp(name, "tmp-", 4) == 0;
+        if (level == 0 && !hex_name(name, ENTRY_NAME) && !tmp)
+            continue;
+
+        char *path = (char*) malloc(strlen(dir) + strlen(name) + 2);
+        if (!path) {
+            ok = false;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, name);
+
+        struct stat st;
+        if (level > 0) {
+            collect(path, level - 1, entries);
+            free(path);
+            continue;
+        }
+        if (lstat(path, &st) < 0 || !S_ISREG(st.st_mode)
+            || (tmp && time(NULL) - st.st_mtime < TMP_GRACE)) {
+            free(path);
+            continue;
+        }
+
+        if (entries->length == entries->capacity) {
+            size_t capacity = entries->capacity ? 2 * entries->capacity : 256;
+            entry *data = (entry*) realloc(entries->data, capacity * sizeof(entry));
+            if (!data) {
+                free(path);
+                ok = false;
+                break;
+            }
+            entries->data = data;
+            entries->capacity = capacity;
+        }
+        entries->data[entries->length++] = (entry) {path, st.st_size, tmp ? INT64_MIN : st.st_mtime};
+    }
+    closedir(handle);
+    return ok;
+}
+
+int64_t yeast_cache_evict(const char *root, uint64_t max)
+{
+    entry_list entries = {NULL, 0, 0};
+    DIR *handle = opendir(root);
+    if (!handle)
+        return -1;
+    closedir(handle);
+    collect(root, 2, &entries);
+
+    uint64_t total = 0;
+    for (size_t i = 0; i < entries.length; i++)
+        total += entries.data[i].size;
+
+    // Least recently used first
+    qsort(entries.data, entries.length, sizeof(entry), compare_entries);
+    int64_t deleted = 0;
+    for (size_t i = 0; i < entries.length; i++) {
+        if (total > max && unlink(entries.data[i].path) == 0) {
+            total -= entries.data[i].size;
+            deleted += entries.data[i].size;
+        }
+        free(entries.data[i].path);
+    }
+    free(entries.data);
+    return deleted;
+}
+
+YEAST_DOC(cache_trim, "DIR MAX",
+          "Delete the least recently used entries in the cache DIR.\n\n"
+          "Entries are deleted until they take at most MAX bytes in total.\n"
+          "Temporary files left over by writers that died count as entries,\n"
+          "and are deleted first.\n"
+          "Return the number of bytes deleted.");
+emacs_value yeast_cache_trim(emacs_env *env, emacs_value _dir, emacs_value _max)
+{
+    YEAST_ASSERT_STRING(_dir);
+    YEAST_ASSERT_INTEGER(_max);
+    intmax_t max = YEAST_EXTRACT_INTEGER(_max);
+    char *dir = YEAST_EXTRACT_STRING(_dir);
+    int64_t deleted = yeast_cache_evict(dir, max < 0 ? 0 : max);
+    free(dir);
+
+    if (deleted < 0) {
+        em_signal_error(env, "could not read cache directory");
+        return em_nil;
+    }
+    return env->make_integer(env, deleted);
+}
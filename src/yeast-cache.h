@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "yeast.h"
+#include "yeast-query.h"
+#include "yeast-text.h"
+
+#ifndef YEAST_CACHE_H
+#define YEAST_CACHE_H
+
+YEAST_DEFUN(cache_trim, emacs_value _dir, emacs_value _max);
+
+/**
+ * On-disk cache of the query results of files, for one language and query.
+ * Entries are files in DIR, which is ROOT/LANGUAGE/GRAMMAR where GRAMMAR
+ * is a fingerprint of the grammar. Each entry is named after the hash of the
+ * contents of a file and the fingerprint QUERY of the query, and holds the
+ * results with character offsets rather than byte offsets.
+ * Entries are read by mapping them into memory, and are written atomically,
+ * so a cache can be used by several threads and processes at once.
+ */
+typedef struct {
+    char *dir;
+    uint64_t query;
+} yeast_cache;
+
+/**
+ * Open the cache for a language and query in a root directory.
+ * Directories are created as needed. Entries for other versions of the
+ * grammar of the language are deleted.
+ * @param cache The cache to initialize.
+ * @param root The root directory.
+ * @param language The language, which must be loaded.
+ * @param query The query.
+ * @return False if the cache directory can't be created.
+ */
+bool yeast_cache_open(yeast_cache *cache, const char *root,
+                      yeast_language *language, const yeast_query *query);
+
+/**
+ * Release the memory held by a cache. Its entries are left on disk.
+ * @param cache The cache.
+ */
+void yeast_cache_close(yeast_cache *cache);
+
+/**
+ * Hash the contents of a text.
+ * @param text The text.
+ * @return The hash.
+ */
+uint64_t yeast_cache_hash(const yeast_text *text);
+
+/**
+ * Look up the query results for a text.
+ * @param cache The cache.
+ * @param hash The hash of the text.
+ * @param length The length of the text in bytes.
+ * @param results The results (initially zeroed), filled in on success.
+ * @return True iff the results were found.
+ */
+bool yeast_cache_lookup(const yeast_cache *cache, uint64_t hash, uint32_t length,
+                        yeast_query_results *results);
+
+/**
+ * Store the query results for a text. Failures are ignored.
+ * @param cache The cache.
+ * @param hash The hash of the text.
+ * @param length The length of the text in bytes.
+ * @param results The results.
+ */
+void yeast_cache_store(const yeast_cache *cache, uint64_t hash, uint32_t length,
+                       const yeast_query_results *results);
+
+/**
+ * Delete the least recently used entries in a cache root directory until
+ * the entries take at most a given number of bytes. Temporary files older
+ * than an hour, left over by writers that died, count as entries and are
+ * deleted first.
+ * @param root The root directory.
+ * @param max The maximal total size of the entries in bytes.
+ * @return The number of bytes deleted, or -1 if ROOT can't be read.
+ */
+int64_t yeast_cache_evict(const char *root, uint64_t max);
+
+#endif /* YEAST_CACHE_H */
@@ -0,0 +1,58 @@
+#include "yeast-changes.h"
+
+void yeast_changes_init(yeast_changes *changes)
+{
+    changes->head = 0;
+    changes->length = 0;
+    changes->floor = 0;
+}
+
+void yeast_changes_reset(yeast_changes *changes, uint64_t generation)
+{
+    changes->head = 0;
+    changes->length = 0;
+    changes->floor = generation;
+}
+
+void yeast_changes_add(yeast_changes *changes, uint64_t generation, uint32_t start, uint32_t end)
+{
+    if (changes->length == YEAST_CHANGES_SIZE) {
+        // Callers that haven't seen the dropped generation must assume everything changed
+        yeast_change *oldest = &changes->entries[changes->head];
+        if (oldest->generation > changes->floor)
+            changes->floor = oldest->generation;
+        changes->head = (changes->head + 1) % YEAST_CHANGES_SIZE;
+        changes->length--;
+    }
+
+    uint32_t index = (changes->head + changes->length) % YEAST_CHANGES_SIZE;
+    changes->entries[index] = (yeast_change) {generation, start, end};
+    changes->length++;
+}
+
+void yeast_changes_map(uint32_t *range_start, uint32_t *range_end,
+                       uint32_t start, uint32_t old_end, uint32_t new_end)
+{
+    if (*range_start >= old_end)
+        *range_start = *range_start - old_end + new_end;
+    else if (*range_start > start)
+        *range_start = start;
+
+    if (*range_end >= old_end)
+        *range_end = *range_end - old_end + new_end;
+    else if (*range_end > start)
+        *range_end = new_end;
+}
+
+void yeast_changes_edit(yeast_changes *changes, uint32_t start, uint32_t old_end, uint32_t new_end)
+{
+    for (uint32_t i = 0; i < changes->length; i++) {
+        yeast_change *change = &changes->entries[(changes->head + i) % YEAST_CHANGES_SIZE];
+        yeast_changes_map(&change->start, &change->end, start, old_end, new_end);
+    }
+}
+
+const yeast_change *yeast_changes_get(const yeast_changes *changes, uint32_t index)
+{
+    return &changes->entries[(changes->head + index) % YEAST_CHANGES_SIZE];
+}
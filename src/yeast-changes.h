@@ -0,0 +1,85 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef YEAST_CHANGES_H
+#define YEAST_CHANGES_H
+
+/**
+ * Number of changed ranges remembered by an instance.
+ */
+#define YEAST_CHANGES_SIZE 64
+
+/**
+ * A byte range whose syntactic structure changed in a parse.
+ */
+typedef struct {
+    uint64_t generation;
+    uint32_t start;
+    uint32_t end;
+} yeast_change;
+
+/**
+ * Ring of the most recently changed ranges, oldest first.
+ * Ranges are kept up to date with later edits of the text. The history is
+ * complete for parses with generations above FLOOR: anything older may have
+ * been dropped, or may have replaced the whole text.
+ */
+typedef struct {
+    yeast_change entries[YEAST_CHANGES_SIZE];
+    uint32_t head;
+    uint32_t length;
+    uint64_t floor;
+} yeast_changes;
+
+/**
+ * Initialize an empty ring.
+ * @param changes The ring.
+ */
+void yeast_changes_init(yeast_changes *changes);
+
+/**
+ * Forget all changes, after a parse that replaced everything.
+ * @param changes The ring.
+ * @param generation The generation of that parse.
+ */
+void yeast_changes_reset(yeast_changes *changes, uint64_t generation);
+
+/**
+ * Add a changed range, dropping the oldest one if the ring is full.
+ * @param changes The ring.
+ * @param generation The generation of the parse that changed the range.
+ * @param start The first byte of the range.
+ * @param end The end of the range.
+ */
+void yeast_changes_add(yeast_changes *changes, uint64_t generation, uint32_t start, uint32_t end);
+
+/**
+ * Update all ranges after an edit of the text.
+ * Ranges touching the replaced text are extended to cover its replacement.
+ * @param changes The ring.
+ * @param start The first byte of the edit.
+ * @param old_end The end of the replaced text, in the old text.
+ * @param new_end The end of the replacement, in the new text.
+ */
+void yeast_changes_edit(yeast_changes *changes, uint32_t start, uint32_t old_end, uint32_t new_end);
+
+/**
+ * Map a range across an edit, like yeast_changes_edit does.
+ * @param range_start Pointer to the first byte of the range.
+ * @param range_end Pointer to the end of the range.
+ * @param start The first byte of the edit.
+ * @param old_end The end of the replaced text, in the old text.
+ * @param new_end The end of the replacement, in the new text.
+ */
+void yeast_changes_map(uint32_t *range_start, uint32_t *range_end,
+                       uint32_t start, uint32_t old_end, uint32_t new_end);
+
+/**
+ * Get a changed range.
+ * @param changes The ring.
+ * @param index The index, from zero (the oldest) to the length of the ring.
+ * @return The range.
+ */
+const yeast_change *yeast_changes_get(const yeast_changes *changes, uint32_t index);
+
+#endif /* YEAST_CHANGES_H */
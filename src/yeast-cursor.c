@@ -0,0 +1,119 @@
+#include "tree_sitter/runtime.h"
+
+#include "interface.h"
+#include "yeast.h"
+#include "yeast-cursor.h"
+#include "yeast-instance.h"
+#include "yeast-traversal.h"
+
+YEAST_DOC(cursor_p, "OBJ", "Return non-nil if OBJ is a yeast cursor.");
+emacs_value yeast_cursor_p(emacs_env *env, emacs_value obj)
+{
+    yeast_type type = yeast_get_type(env, obj);
+    return type == YEAST_CURSOR ? em_t : em_nil;
+}
+
+YEAST_DOC(cursor_new, "NODE",
+          "Make a new cursor starting at NODE.\n\n"
+          "The cursor can not move above NODE.");
+emacs_value yeast_cursor_new(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+
+    yeast_retain(node->tree);
+    yeast_cursor *retval = (yeast_cursor*) malloc(sizeof(yeast_cursor));
+    *retval = (yeast_cursor) {{YEAST_CURSOR, 0}, node->tree, ts_tree_cursor_new(node->node)};
+    return env->make_user_ptr(env, yeast_finalize, retval);
+}
+
+YEAST_DOC(cursor_goto_first_child, "CURSOR",
+          "Move CURSOR to the first child of its current node.\n\n"
+          "Return non-nil if it moved.");
+emacs_value yeast_cursor_goto_first_child(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    return ts_tree_cursor_goto_first_child(&cursor->cursor) ? em_t : em_nil;
+}
+
+YEAST_DOC(cursor_goto_next_sibling, "CURSOR",
+          "Move CURSOR to the next sibling of its current node.\n\n"
+          "Return non-nil if it moved.");
+emacs_value yeast_cursor_goto_next_sibling(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    return ts_tree_cursor_goto_next_sibling(&cursor->cursor) ? em_t : em_nil;
+}
+
+YEAST_DOC(cursor_goto_parent, "CURSOR",
+          "Move CURSOR to the parent of its current node.\n\n"
+          "Return non-nil if it moved.");
+emacs_value yeast_cursor_goto_parent(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    return ts_tree_cursor_goto_parent(&cursor->cursor) ? em_t : em_nil;
+}
+
+YEAST_DOC(cursor_type, "CURSOR", "Get the type of the current node of CURSOR.");
+emacs_value yeast_cursor_type(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    yeast_language *language = cursor->tree->instance->language;
+    return yeast_language_type(env, language, ts_node_symbol(node));
+}
+
+YEAST_DOC(cursor_symbol, "CURSOR", "Get the grammar symbol id of the current node of CURSOR.");
+emacs_value yeast_cursor_symbol(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    return env->make_integer(env, ts_node_symbol(node));
+}
+
+YEAST_DOC(cursor_named_p, "CURSOR", "Return non-nil if the current node of CURSOR is named.");
+emacs_value yeast_cursor_named_p(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    return ts_node_is_named(node) ? em_t : em_nil;
+}
+
+YEAST_DOC(cursor_byte_range, "CURSOR",
+          "Get the byte range of the current node of CURSOR as a cons cell.");
+emacs_value yeast_cursor_byte_range(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    return em_cons(
+        env,
+        env->make_integer(env, 1 + ts_node_start_byte(node)),
+        env->make_integer(env, ts_node_end_byte(node))
+    );
+}
+
+YEAST_DOC(cursor_range, "CURSOR",
+          "Get the range of buffer positions of the current node of CURSOR as a cons cell.");
+emacs_value yeast_cursor_range(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    return yeast_instance_range(env, cursor->tree->instance, ts_node_start_byte(node), ts_node_end_byte(node));
+}
+
+YEAST_DOC(cursor_node, "CURSOR", "Get the current node of CURSOR as a node object.");
+emacs_value yeast_cursor_node(emacs_env *env, emacs_value _cursor)
+{
+    YEAST_ASSERT_CURSOR(_cursor);
+    yeast_cursor *cursor = YEAST_EXTRACT_CURSOR(_cursor);
+    TSNode node = ts_tree_cursor_current_node(&cursor->cursor);
+    return yeast_tree_node(env, cursor->tree, node);
+}
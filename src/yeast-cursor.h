@@ -0,0 +1,20 @@
+#include "yeast.h"
+
+#ifndef YEAST_CURSOR_H
+#define YEAST_CURSOR_H
+
+YEAST_DEFUN(cursor_p, emacs_value obj);
+YEAST_DEFUN(cursor_new, emacs_value _node);
+
+YEAST_DEFUN(cursor_goto_first_child, emacs_value _cursor);
+YEAST_DEFUN(cursor_goto_next_sibling, emacs_value _cursor);
+YEAST_DEFUN(cursor_goto_parent, emacs_value _cursor);
+
+YEAST_DEFUN(cursor_type, emacs_value _cursor);
+YEAST_DEFUN(cursor_symbol, emacs_value _cursor);
+YEAST_DEFUN(cursor_named_p, emacs_value _cursor);
+YEAST_DEFUN(cursor_byte_range, emacs_value _cursor);
+YEAST_DEFUN(cursor_range, emacs_value _cursor);
+YEAST_DEFUN(cursor_node, emacs_value _cursor);
+
+#endif /* YEAST_CURSOR_H */
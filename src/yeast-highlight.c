@@ -0,0 +1,173 @@
+#include <stdlib.h>
+
+#include "tree_sitter/runtime.h"
+
+#include "interface.h"
+#include "yeast.h"
+#include "yeast-highlight.h"
+#include "yeast-instance.h"
+#include "yeast-query.h"
+
+/**
+ * A captured byte range, and the order in which it was found.
+ */
+typedef struct {
+    uint32_t start;
+    uint32_t end;
+    uint32_t capture;
+    uint32_t order;
+} span;
+
+/**
+ * Order spans by start, then outer before inner, then by discovery.
+ */
+static int compare_spans(const void *_a, const void *_b)
+{
+    const span *a = (const span*) _a, *b = (const span*) _b;
+    if (a->start != b->start)
+        return a->start < b->start ? -1 : 1;
+    if (a->end != b->end)
+        return a->end > b->end ? -1 : 1;
+    return a->order < b->order ? -1 : (a->order > b->order);
+}
+
+/**
+ * Accumulates face runs, merging adjacent runs with the same face.
+ * Runs without a face are dropped, and the others kept as triples in RUNS.
+ */
+typedef struct {
+    uint32_t *runs;
+    size_t length;
+    uint32_t start;
+    uint32_t end;
+    int64_t face;
+} face_writer;
+
+static void flush_run(face_writer *writer)
+{
+    if (writer->start == writer->end || writer->face < 0)
+        return;
+    uint32_t *run = writer->runs + writer->length;
+    run[0] = writer->start;
+    run[1] = writer->end;
+    run[2] = writer->face;
+    writer->length += 3;
+}
+
+static void write_run(face_writer *writer, uint32_t start, uint32_t end, int64_t face)
+{
+    if (start >= end)
+        return;
+    if (face == writer->face && start == writer->end) {
+        writer->end = end;
+        return;
+    }
+    flush_run(writer);
+    writer->start = start;
+    writer->end = end;
+    writer->face = face;
+}
+
+YEAST_DOC(highlight, "TREE QUERY BEG END",
+          "Compute the faces between BEG and END according to QUERY, using TREE.\n\n"
+          "The name of each capture in QUERY is the face of the captured nodes.\n"
+          "Where captures are nested, the innermost one wins. Return a vector\n"
+          "[BEG END FACE ...] with three elements per run of text with a face,\n"
+          "in order. Adjacent runs have different faces. Text in the region that\n"
+          "isn't captured is in no run. See `yeast--apply-faces'.");
+emacs_value yeast_highlight(emacs_env *env, emacs_value _tree, emacs_value _query,
+                            emacs_value _beg, emacs_value _end)
+{
+    YEAST_ASSERT_TREE(_tree);
+    YEAST_ASSERT_QUERY(_query);
+    YEAST_ASSERT_INTEGER(_beg);
+    YEAST_ASSERT_INTEGER(_end);
+    yeast_tree *tree = YEAST_EXTRACT_TREE(_tree);
+    yeast_query *query = YEAST_EXTRACT_QUERY(_query);
+    yeast_instance *instance = tree->instance;
+    intmax_t _beg_pos = YEAST_EXTRACT_INTEGER(_beg);
+    intmax_t _end_pos = YEAST_EXTRACT_INTEGER(_end);
+
+    if (instance->language != query->language) {
+        em_signal_error(env, "query and tree have different languages");
+        return em_nil;
+    }
+
+    uint32_t beg = yeast_instance_byte(instance, _beg_pos);
+    uint32_t end = yeast_instance_byte(instance, _end_pos);
+    if (beg >= end)
+        return em_vector(env, 0, NULL);
+
+    yeast_query_results results = {NULL, 0, 0};
+    if (!yeast_query_exec(query, ts_tree_root_node(tree->tree), beg, end, &results)) {
+        free(results.data);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+
+    size_t nspans = results.length / 4;
+    span *spans = (span*) malloc((nspans + 1) * sizeof(span));
+    span *stack = (span*) malloc((nspans + 1) * sizeof(span));
+    // The sweep below writes a run when it reaches a span and when it leaves one
+    uint32_t *runs = (uint32_t*) malloc((2 * nspans + 1) * 3 * sizeof(uint32_t));
+    if (!spans || !stack || !runs) {
+        free(spans);
+        free(stack);
+        free(runs);
+        free(results.data);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+
+    for (size_t i = 0; i < nspans; i++) {
+        uint32_t *r = results.data + 4 * i;
+        spans[i] = (span) {r[2] < beg ? beg : r[2], r[3] > end ? end : r[3], r[1], (uint32_t) i};
+    }
+    free(results.data);
+    qsort(spans, nspans, sizeof(span), compare_spans);
+
+    // Sweep through the spans, keeping a stack of the ones containing the
+    // current position. The top of the stack determines the face.
+    face_writer writer = {runs, 0, beg, beg, -1};
+    uint32_t pos = beg;
+    size_t depth = 0;
+    for (size_t i = 0; i <= nspans; i++) {
+        uint32_t next = i < nspans ? spans[i].start : end;
+        while (depth > 0 && stack[depth - 1].end <= next) {
+            span *top = &stack[--depth];
+            write_run(&writer, pos, top->end, top->capture);
+            if (top->end > pos)
+                pos = top->end;
+        }
+        write_run(&writer, pos, next, depth > 0 ? (int64_t) stack[depth - 1].capture : -1);
+        if (next > pos)
+            pos = next;
+        if (i < nspans)
+            stack[depth++] = spans[i];
+    }
+    flush_run(&writer);
+    free(spans);
+    free(stack);
+
+    emacs_value *faces = (emacs_value*) malloc((query->ncaptures + 1) * sizeof(emacs_value));
+    emacs_value *values = (emacs_value*) malloc((writer.length + 1) * sizeof(emacs_value));
+    if (!faces || !values) {
+        free(faces);
+        free(values);
+        free(runs);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    for (uint32_t i = 0; i < query->ncaptures; i++)
+        faces[i] = env->intern(env, query->captures[i]);
+    for (size_t i = 0; i < writer.length; i += 3) {
+        values[i] = env->make_integer(env, yeast_instance_position(instance, runs[i]));
+        values[i + 1] = env->make_integer(env, yeast_instance_position(instance, runs[i + 1]));
+        values[i + 2] = faces[runs[i + 2]];
+    }
+    emacs_value retval = em_vector(env, writer.length, values);
+    free(faces);
+    free(values);
+    free(runs);
+    return retval;
+}
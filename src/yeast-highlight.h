@@ -0,0 +1,8 @@
+#include "yeast.h"
+
+#ifndef YEAST_HIGHLIGHT_H
+#define YEAST_HIGHLIGHT_H
+
+YEAST_DEFUN(highlight, emacs_value _tree, emacs_value _query, emacs_value _beg, emacs_value _end);
+
+#endif /* YEAST_HIGHLIGHT_H */
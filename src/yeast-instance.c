@@ -1,71 +1,143 @@
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
 #include "tree_sitter/runtime.h"
 
 #include "interface.h"
 #include "yeast.h"
 #include "yeast-instance.h"
 
-#define BUFSIZE 4092
-
-TSLanguage *tree_sitter_bash();
-TSLanguage *tree_sitter_c();
-TSLanguage *tree_sitter_cpp();
-TSLanguage *tree_sitter_css();
-TSLanguage *tree_sitter_go();
-TSLanguage *tree_sitter_html();
-TSLanguage *tree_sitter_javascript();
-TSLanguage *tree_sitter_json();
-TSLanguage *tree_sitter_ocaml();
-TSLanguage *tree_sitter_php();
-TSLanguage *tree_sitter_python();
-TSLanguage *tree_sitter_ruby();
-TSLanguage *tree_sitter_rust();
-TSLanguage *tree_sitter_typescript();
+// Instances visible to Emacs, for aggregate counters. The last reference to an
+// instance may be dropped by a background parse, so the list has a lock.
+static pthread_mutex_t instances_lock = PTHREAD_MUTEX_INITIALIZER;
+static yeast_instance *instances = NULL;
+
+/**
+ * Add an instance to the list of live instances.
+ * Its counters must not be updated outside the main thread afterwards.
+ */
+static void link_instance(yeast_instance *instance)
+{
+    pthread_mutex_lock(&instances_lock);
+    instance->prev = NULL;
+    instance->next = instances;
+    if (instances)
+        instances->prev = instance;
+    instances = instance;
+    pthread_mutex_unlock(&instances_lock);
+}
+
+/**
+ * Remove an instance from the list of live instances, if it's there.
+ */
+static void unlink_instance(yeast_instance *instance)
+{
+    pthread_mutex_lock(&instances_lock);
+    if (instance->prev)
+        instance->prev->next = instance->next;
+    else if (instances == instance)
+        instances = instance->next;
+    if (instance->next)
+        instance->next->prev = instance->prev;
+    pthread_mutex_unlock(&instances_lock);
+}
+
+/**
+ * Allocate an instance with an empty text and no tree.
+ * @return The instance, or NULL if out of memory.
+ */
+static yeast_instance *new_instance(yeast_language *language)
+{
+    yeast_instance *retval = (yeast_instance*) malloc(sizeof(yeast_instance));
+    if (!retval)
+        return NULL;
+    *retval = (yeast_instance) {{YEAST_INSTANCE, 1}, language, NULL};
+    yeast_text_init(&retval->text);
+    yeast_offsets_init(&retval->offsets);
+    yeast_lines_init(&retval->lines);
+    yeast_changes_init(&retval->changes);
+    return retval;
+}
 
 YEAST_DOC(make_instance, "LANGUAGE", "Make a new yeast instance for the given LANGUAGE.");
 emacs_value yeast_make_instance(emacs_env *env, emacs_value language)
 {
     YEAST_ASSERT_SYMBOL(language);
-    TSParser *parser = ts_parser_new();
-
-    if (env->eq(env, language, em_bash))
-        ts_parser_set_language(parser, tree_sitter_bash());
-    else if (env->eq(env, language, em_c))
-        ts_parser_set_language(parser, tree_sitter_c());
-    else if (env->eq(env, language, em_cpp))
-        ts_parser_set_language(parser, tree_sitter_cpp());
-    else if (env->eq(env, language, em_css))
-        ts_parser_set_language(parser, tree_sitter_css());
-    else if (env->eq(env, language, em_go))
-        ts_parser_set_language(parser, tree_sitter_go());
-    else if (env->eq(env, language, em_html))
-        ts_parser_set_language(parser, tree_sitter_html());
-    else if (env->eq(env, language, em_javascript))
-        ts_parser_set_language(parser, tree_sitter_javascript());
-    else if (env->eq(env, language, em_json))
-        ts_parser_set_language(parser, tree_sitter_json());
-    else if (env->eq(env, language, em_ocaml))
-        ts_parser_set_language(parser, tree_sitter_ocaml());
-    else if (env->eq(env, language, em_php))
-        ts_parser_set_language(parser, tree_sitter_php());
-    else if (env->eq(env, language, em_python))
-        ts_parser_set_language(parser, tree_sitter_python());
-    else if (env->eq(env, language, em_ruby))
-        ts_parser_set_language(parser, tree_sitter_ruby());
-    else if (env->eq(env, language, em_rust))
-        ts_parser_set_language(parser, tree_sitter_rust());
-    else if (env->eq(env, language, em_typescript))
-        ts_parser_set_language(parser, tree_sitter_typescript());
-    else {
-        ts_parser_delete(parser);
-        env->non_local_exit_signal(env, em_unknown_language, em_cons(env, language, em_nil));
+    yeast_language *lang = yeast_language_find(env, language);
+    if (!lang)
         return em_nil;
-    }
 
-    yeast_instance *retval = (yeast_instance*) malloc(sizeof(yeast_instance));
-    *retval = (yeast_instance) {{YEAST_INSTANCE, 1}, parser, NULL};
+    yeast_instance *retval = new_instance(lang);
+    if (!retval) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    link_instance(retval);
     return env->make_user_ptr(env, yeast_finalize, retval);
 }
 
+YEAST_DOC(register_language, "NAME PATH &optional FUNCTION",
+          "Register the language NAME, with a grammar in the shared object PATH.\n\n"
+          "FUNCTION is the name of the function in PATH that returns the\n"
+          "language, by default tree_sitter_NAME. The grammar is only loaded\n"
+          "the first time the language is used. A language that's already\n"
+          "loaded can't be registered again.");
+emacs_value yeast_register_language(emacs_env *env, emacs_value _name, emacs_value _path, emacs_value _function)
+{
+    YEAST_ASSERT_SYMBOL(_name);
+    YEAST_ASSERT_STRING(_path);
+    if (YEAST_EXTRACT_BOOLEAN(_function))
+        YEAST_ASSERT_STRING(_function);
+
+    char *name = em_symbol_name(env, _name);
+    char *path = YEAST_EXTRACT_STRING(_path);
+    char *function = NULL;
+    if (YEAST_EXTRACT_BOOLEAN(_function))
+        function = YEAST_EXTRACT_STRING(_function);
+
+    bool success = yeast_language_register(name, path, function);
+    free(name);
+    free(path);
+    free(function);
+
+    if (!success) {
+        em_signal_error(env, "could not register language");
+        return em_nil;
+    }
+    return em_t;
+}
+
+YEAST_DOC(language_types, "LANGUAGE &optional KIND",
+          "Get a vector of the node types of LANGUAGE, indexed by grammar symbol id.\n\n"
+          "If KIND is `named' or `anonymous', other kinds of types are replaced by nil.");
+emacs_value yeast_language_types(emacs_env *env, emacs_value language, emacs_value kind)
+{
+    YEAST_ASSERT_SYMBOL(language);
+    yeast_language *lang = yeast_language_find(env, language);
+    if (!lang)
+        return em_nil;
+
+    bool all = !YEAST_EXTRACT_BOOLEAN(kind);
+    TSSymbolType wanted = env->eq(env, kind, em_named) ? TSSymbolTypeRegular : TSSymbolTypeAnonymous;
+
+    const TSLanguage *ts_language = lang->language;
+    uint32_t ntypes = ts_language_symbol_count(ts_language);
+    emacs_value *types = (emacs_value*) malloc(ntypes * sizeof(emacs_value));
+    if (!types) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    for (uint32_t i = 0; i < ntypes; i++) {
+        bool keep = all || ts_language_symbol_type(ts_language, (TSSymbol) i) == wanted;
+        types[i] = keep ? yeast_language_type(env, lang, (TSSymbol) i) : em_nil;
+    }
+
+    emacs_value retval = em_vector(env, ntypes, types);
+    free(types);
+    return retval;
+}
+
 YEAST_DOC(instance_p, "OBJ", "Return non-nil if OBJ is a yeast instance.");
 emacs_value yeast_instance_p(emacs_env *env, emacs_value obj)
 {
@@ -73,69 +145,581 @@ emacs_value yeast_instance_p(emacs_env *env, emacs_value obj)
     return type == YEAST_INSTANCE ? em_t : em_nil;
 }
 
+/**
+ * The input of a parser: a text, and counters for the reads from it.
+ */
 typedef struct {
-    emacs_env *env;
-    uint32_t size;
-    bool success;
-    char buffer[BUFSIZE + 1];
-} read_payload;
+    yeast_text *text;
+    uint64_t reads;
+    uint64_t bytes;
+} input;
 
 static const char *read(void *_payload, uint32_t offset, TSPoint position, uint32_t *bytes_read)
 {
-    read_payload *payload = (read_payload*)_payload;
+    input *payload = (input*) _payload;
+    const char *chunk = yeast_text_chunk(payload->text, offset, bytes_read);
+    payload->reads++;
+    payload->bytes += *bytes_read;
+    return chunk;
+}
+
+static uint64_t now(void)
+{
+    struct timespec time;
+    clock_gettime(CLOCK_MONOTONIC, &time);
+    return (uint64_t) time.tv_sec * 1000000000 + time.tv_nsec;
+}
+
+/**
+ * Run a parser over a text, and add the time it took and what it read to COUNTS.
+ * @return The new tree, or NULL if the parser ran out of time.
+ */
+static TSTree *run_parser(TSParser *parser, TSTree *old_tree, yeast_text *text, yeast_parse_counts *counts)
+{
+    input payload = {text, 0, 0};
+    TSInput input = {&payload, read, TSInputEncodingUTF8};
+    uint64_t start = now();
+    TSTree *retval = ts_parser_parse(parser, old_tree, input);
+    uint64_t elapsed = now() - start;
+
+    counts->parse_time += elapsed;
+    if (elapsed > counts->max_parse_time)
+        counts->max_parse_time = elapsed;
+    counts->reads += payload.reads;
+    counts->bytes_read += payload.bytes;
+    return retval;
+}
 
-    // Calculate how many bytes to read
-    *bytes_read = payload->size - offset;
-    if (*bytes_read > BUFSIZE)
-        *bytes_read = BUFSIZE;
-    if (*bytes_read <= 0) {
-        *bytes_read = 0;
-        return "";
+/**
+ * Replace the tree of an instance with a freshly parsed one, and record the
+ * ranges that changed since OLD_TREE, which is then deleted.
+ * OLD_TREE is NULL if the new tree was parsed from scratch.
+ */
+static void install(yeast_instance *instance, TSTree *old_tree, TSTree *new_tree)
+{
+    instance->tree = new_tree;
+    instance->generation++;
+    instance->counts.parses++;
+
+    if (!old_tree) {
+        yeast_changes_reset(&instance->changes, instance->generation);
+        return;
     }
 
-    bool retval = em_buffer_contents(payload->env, offset, *bytes_read, &payload->buffer[0]);
-    if (!retval) {
-        *bytes_read = 0;
-        payload->success = false;
-        return "";
+    uint32_t nranges;
+    TSRange *ranges = ts_tree_get_changed_ranges(old_tree, new_tree, &nranges);
+    for (uint32_t i = 0; i < nranges; i++)
+        yeast_changes_add(&instance->changes, instance->generation,
+                          ranges[i].start_byte, ranges[i].end_byte);
+    free(ranges);
+    ts_tree_delete(old_tree);
+}
+
+/**
+ * Parse the text mirror of an instance with a given parser, overriding the current tree.
+ */
+static void parse_with(yeast_instance *instance, TSParser *parser)
+{
+    TSTree *new_tree = run_parser(parser, instance->tree, &instance->text, &instance->counts);
+    // The parser gives up on grammars it can't use
+    if (new_tree)
+        install(instance, instance->tree, new_tree);
+}
+
+/**
+ * Parse the text mirror of an instance, overriding the current tree.
+ * If no parser is available, the tree is left as it is, with edits applied.
+ * This never calls back into Emacs.
+ */
+static void reparse(yeast_instance *instance)
+{
+    TSParser *parser = yeast_language_acquire(instance->language);
+    if (!parser)
+        return;
+
+    parse_with(instance, parser);
+    yeast_language_release(instance->language, parser);
+}
+
+/**
+ * Abandon the stepped parse of an instance, if there is one.
+ * The edits it had taken from the queue are lost, so the next parse is
+ * marked to start from scratch.
+ */
+static void abandon(yeast_instance *instance)
+{
+    yeast_resume *resume = &instance->resume;
+    if (resume->parser) {
+        ts_parser_reset(resume->parser);
+        ts_parser_set_timeout_micros(resume->parser, 0);
+        yeast_language_release(instance->language, resume->parser);
     }
+    if (resume->tree)
+        ts_tree_delete(resume->tree);
+    *resume = (yeast_resume) {NULL, NULL, 0, true};
+}
 
-    return &payload->buffer[0];
+/**
+ * Apply all queued edits to the tree of an instance.
+ */
+static void apply_edits(yeast_instance *instance)
+{
+    // A stepped parse works on its own copy of the tree
+    yeast_edit_queue *queue = &instance->queue;
+    TSTree *tree = instance->resume.parser ? instance->resume.tree : instance->tree;
+    if (tree)
+        for (uint32_t i = 0; i < queue->length; i++)
+            ts_tree_edit(tree, &queue->edits[i]);
+    queue->length = 0;
 }
 
-static emacs_value reparse(emacs_env *env, yeast_instance *instance)
+/**
+ * Add an edit to the queue of an instance.
+ * If the edit falls within the new text of the previous edit, the two are merged.
+ * This must be called after the text and line table have been updated.
+ */
+static void enqueue(yeast_instance *instance, TSInputEdit edit)
 {
-    read_payload payload;
-    payload.env = env;
-    payload.size = em_buffer_size(env);
-    payload.success = true;
+    yeast_edit_queue *queue = &instance->queue;
+    queue->count++;
 
-    TSInput input = {&payload, read, TSInputEncodingUTF8};
-    TSTree *new_tree = ts_parser_parse(instance->parser, instance->tree, input);
+    if (queue->length > 0) {
+        TSInputEdit *prev = &queue->edits[queue->length - 1];
+        if (edit.start_byte >= prev->start_byte && edit.old_end_byte <= prev->new_end_byte) {
+            prev->new_end_byte = prev->new_end_byte - edit.old_end_byte + edit.new_end_byte;
+            prev->new_end_point = yeast_lines_point(&instance->lines, prev->new_end_byte);
+            return;
+        }
+    }
+
+    if (queue->length == queue->capacity) {
+        uint32_t capacity = queue->capacity ? 2 * queue->capacity : 16;
+        TSInputEdit *edits = (TSInputEdit*) realloc(queue->edits, capacity * sizeof(TSInputEdit));
+        if (!edits) {
+            // Out of memory: edit the tree right away instead
+            apply_edits(instance);
+            TSTree *tree = instance->resume.parser ? instance->resume.tree : instance->tree;
+            if (tree)
+                ts_tree_edit(tree, &edit);
+            return;
+        }
+        queue->edits = edits;
+        queue->capacity = capacity;
+    }
+
+    queue->edits[queue->length++] = edit;
+}
+
+/**
+ * Update the parse counters of an instance.
+ */
+static void count_parse(yeast_instance *instance, uint32_t merged)
+{
+    yeast_parse_counts *counts = &instance->counts;
+    counts->edits += merged;
+    counts->last_merged = merged;
+    if (merged > counts->max_merged)
+        counts->max_merged = merged;
+}
+
+struct yeast_job {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    bool done;
+    yeast_instance *instance;
+    yeast_text text;
+    TSParser *parser;
+    TSTree *tree;
+    TSRange *ranges;
+    uint32_t nranges;
+    bool full;
+    uint32_t merged;
+    yeast_parse_counts counts;
+};
+
+/**
+ * Thread entry point for a background parse.
+ * The job owns a snapshot of the text and a copy of the old tree with all
+ * edits applied, and a parser borrowed for it.
+ */
+static void *run_job(void *_job)
+{
+    yeast_job *job = (yeast_job*) _job;
+    yeast_instance *instance = job->instance;
 
-    emacs_value retval = payload.success ? em_t : em_nil;
+    TSTree *new_tree = run_parser(job->parser, job->tree, &job->text, &job->counts);
+    yeast_language_release(instance->language, job->parser);
+    job->parser = NULL;
+    if (new_tree && job->tree) {
+        job->ranges = ts_tree_get_changed_ranges(job->tree, new_tree, &job->nranges);
+        ts_tree_delete(job->tree);
+    }
+    else {
+        // If the parser gave up, the old tree with the edits applied is published
+        if (!new_tree)
+            new_tree = job->tree;
+        job->full = true;
+    }
+
+    pthread_mutex_lock(&job->lock);
+    job->tree = new_tree;
+    job->done = true;
+    pthread_cond_broadcast(&job->cond);
+    pthread_mutex_unlock(&job->lock);
+
+    // This may destroy the instance, and the job with it
+    yeast_finalize(instance);
+    return NULL;
+}
+
+static void free_job(yeast_job *job)
+{
+    if (job->parser)
+        yeast_language_release(job->instance->language, job->parser);
+    if (job->tree)
+        ts_tree_delete(job->tree);
+    free(job->ranges);
+    yeast_text_free(&job->text);
+    pthread_mutex_destroy(&job->lock);
+    pthread_cond_destroy(&job->cond);
+    free(job);
+}
+
+/**
+ * Replace the tree of an instance with the result of its finished job.
+ */
+static void publish(yeast_instance *instance)
+{
+    yeast_job *job = instance->job;
+    instance->job = NULL;
 
     if (instance->tree)
         ts_tree_delete(instance->tree);
-    instance->tree = new_tree;
+    instance->tree = job->tree;
+    instance->generation++;
+    job->tree = NULL;
+    instance->counts.parses++;
+    count_parse(instance, job->merged);
 
-    return retval;
+    // The counters of the job are only read once it's done
+    yeast_parse_counts *counts = &instance->counts;
+    counts->parse_time += job->counts.parse_time;
+    if (job->counts.max_parse_time > counts->max_parse_time)
+        counts->max_parse_time = job->counts.max_parse_time;
+    counts->reads += job->counts.reads;
+    counts->bytes_read += job->counts.bytes_read;
+
+    // The changed ranges are relative to the text of the job, so they must
+    // be moved past the edits queued while it was running
+    if (job->full)
+        yeast_changes_reset(&instance->changes, instance->generation);
+    for (uint32_t i = 0; i < job->nranges; i++) {
+        uint32_t start = job->ranges[i].start_byte, end = job->ranges[i].end_byte;
+        for (uint32_t j = 0; j < instance->queue.length; j++) {
+            TSInputEdit *edit = &instance->queue.edits[j];
+            yeast_changes_map(&start, &end, edit->start_byte, edit->old_end_byte, edit->new_end_byte);
+        }
+        yeast_changes_add(&instance->changes, instance->generation, start, end);
+    }
+
+    free_job(job);
+}
+
+/**
+ * Wait for the job of an instance to finish, and publish its result.
+ */
+static void wait_job(yeast_instance *instance)
+{
+    yeast_job *job = instance->job;
+    if (!job)
+        return;
+
+    pthread_mutex_lock(&job->lock);
+    while (!job->done)
+        pthread_cond_wait(&job->cond, &job->lock);
+    pthread_mutex_unlock(&job->lock);
+
+    publish(instance);
+}
+
+bool yeast_instance_poll(yeast_instance *instance)
+{
+    yeast_job *job = instance->job;
+    if (!job)
+        return false;
+
+    pthread_mutex_lock(&job->lock);
+    bool done = job->done;
+    pthread_mutex_unlock(&job->lock);
+
+    if (done)
+        publish(instance);
+    return done;
+}
+
+bool yeast_instance_start(yeast_instance *instance)
+{
+    if (instance->job || instance->resume.parser || instance->resume.full || instance->queue.count == 0)
+        return false;
+
+    yeast_job *job = (yeast_job*) malloc(sizeof(yeast_job));
+    if (!job)
+        return false;
+    job->parser = yeast_language_acquire(instance->language);
+    if (!job->parser) {
+        free(job);
+        return false;
+    }
+    if (!yeast_text_copy(&job->text, &instance->text)) {
+        yeast_language_release(instance->language, job->parser);
+        free(job);
+        return false;
+    }
+
+    pthread_mutex_init(&job->lock, NULL);
+    pthread_cond_init(&job->cond, NULL);
+    job->done = false;
+    job->instance = instance;
+    job->ranges = NULL;
+    job->nranges = 0;
+    job->full = false;
+    job->merged = instance->queue.count;
+    job->counts = (yeast_parse_counts) {0};
+
+    // The current tree is left untouched, so that readers can keep using it
+    job->tree = instance->tree ? ts_tree_copy(instance->tree) : NULL;
+    if (job->tree)
+        for (uint32_t i = 0; i < instance->queue.length; i++)
+            ts_tree_edit(job->tree, &instance->queue.edits[i]);
+
+    // The job keeps the instance alive until it's done
+    yeast_retain(instance);
+
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int error = pthread_create(&thread, &attr, run_job, job);
+    pthread_attr_destroy(&attr);
+
+    if (error) {
+        yeast_finalize(instance);
+        free_job(job);
+        return false;
+    }
+
+    instance->job = job;
+    instance->queue.length = 0;
+    instance->queue.count = 0;
+    return true;
+}
+
+bool yeast_instance_step(yeast_instance *instance, uint64_t budget)
+{
+    // Stepping never waits for a background parse
+    if (instance->job)
+        return yeast_instance_poll(instance) && instance->queue.count == 0;
+
+    yeast_resume *resume = &instance->resume;
+    if (!resume->parser) {
+        if (instance->tree && instance->queue.count == 0 && !resume->full)
+            return true;
+        resume->parser = yeast_language_acquire(instance->language);
+        if (!resume->parser)
+            return false;
+        // The current tree is left untouched, so that readers can keep using it
+        resume->tree = instance->tree && !resume->full ? ts_tree_copy(instance->tree) : NULL;
+        resume->merged = 0;
+    }
+    else if (instance->queue.count > 0) {
+        // The text changed under the interrupted parse, so it can't be resumed
+        ts_parser_reset(resume->parser);
+    }
+
+    apply_edits(instance);
+    resume->merged += instance->queue.count;
+    instance->queue.count = 0;
+
+    // Without a time limit, this is an ordinary parse
+    ts_parser_set_timeout_micros(resume->parser, budget);
+    TSTree *new_tree = run_parser(resume->parser, resume->tree, &instance->text, &instance->counts);
+    if (!new_tree)
+        return false;
+
+    ts_parser_set_timeout_micros(resume->parser, 0);
+    yeast_language_release(instance->language, resume->parser);
+    if (instance->tree)
+        ts_tree_delete(instance->tree);
+    install(instance, resume->tree, new_tree);
+    count_parse(instance, resume->merged);
+    *resume = (yeast_resume) {NULL, NULL, 0, false};
+    return true;
+}
+
+uint32_t yeast_instance_flush(yeast_instance *instance)
+{
+    wait_job(instance);
+    // Finish a suspended parse, or a full one if the text was replaced under the
+    // tree, along with the pending edits
+    if (instance->resume.parser || instance->resume.full) {
+        uint32_t merged = instance->resume.merged + instance->queue.count;
+        return yeast_instance_step(instance, 0) ? merged : 0;
+    }
+
+    uint32_t merged = instance->queue.count;
+    if (merged == 0)
+        return 0;
+
+    apply_edits(instance);
+    instance->queue.count = 0;
+    reparse(instance);
+    count_parse(instance, merged);
+
+    return merged;
+}
+
+void yeast_instance_update(yeast_instance *instance)
+{
+    if (instance->budget)
+        yeast_instance_step(instance, instance->budget);
+    else if (instance->async && instance->tree && !instance->resume.parser && !instance->resume.full) {
+        yeast_instance_poll(instance);
+        yeast_instance_start(instance);
+    }
+    else
+        yeast_instance_flush(instance);
+}
+
+void yeast_instance_destroy(yeast_instance *instance)
+{
+    unlink_instance(instance);
+    // If there is a job, it's finished, since it holds a reference
+    if (instance->job)
+        free_job(instance->job);
+    abandon(instance);
+    if (instance->tree)
+        ts_tree_delete(instance->tree);
+    yeast_text_free(&instance->text);
+    yeast_offsets_free(&instance->offsets);
+    yeast_lines_free(&instance->lines);
+    free(instance->queue.edits);
+    free(instance);
+}
+
+/**
+ * Replace a byte range in the text mirror of an instance by a region of the current buffer.
+ * @return The number of bytes inserted, or -1 on failure.
+ */
+static int64_t fetch(
+    emacs_env *env, yeast_instance *instance,
+    uint32_t start, uint32_t end, intmax_t beg_pos, intmax_t end_pos)
+{
+    ptrdiff_t size;
+    emacs_value string = em_buffer_substring(env, beg_pos, end_pos, &size);
+    if (size <= 0)
+        return -1;
+
+    char *dest = yeast_text_reserve(&instance->text, start, end, size - 1);
+    if (!dest || !env->copy_string_contents(env, string, dest, &size))
+        return -1;
+
+    yeast_text_commit(&instance->text, size - 1);
+    yeast_offsets_edit(&instance->offsets, &instance->text, start, end, start + size - 1);
+    if (!yeast_lines_edit(&instance->lines, &instance->text, start, end, start + size - 1))
+        return -1;
+    return size - 1;
+}
+
+/**
+ * Replace the text mirror of an instance with the contents of the current buffer,
+ * and parse it from scratch. With a time budget, the parse may not be finished,
+ * and the old tree is served until it is.
+ */
+static emacs_value refill(emacs_env *env, yeast_instance *instance)
+{
+    wait_job(instance);
+    abandon(instance);
+    instance->queue.length = 0;
+    instance->queue.count = 0;
+
+    yeast_text_free(&instance->text);
+    yeast_offsets_free(&instance->offsets);
+    yeast_lines_free(&instance->lines);
+    if (fetch(env, instance, 0, 0, 1, em_buffer_size(env) + 1) < 0)
+        return em_nil;
+
+    yeast_instance_step(instance, instance->budget);
+    return em_t;
+}
+
+yeast_instance *yeast_instance_from_text(yeast_language *language, yeast_text *text, TSParser *parser)
+{
+    yeast_instance *instance = new_instance(language);
+    if (!instance) {
+        yeast_text_free(text);
+        return NULL;
+    }
+
+    instance->text = *text;
+    yeast_text_init(text);
+    if (!yeast_lines_edit(&instance->lines, &instance->text, 0, 0, yeast_text_length(&instance->text))) {
+        yeast_instance_destroy(instance);
+        return NULL;
+    }
+
+    if (parser)
+        parse_with(instance, parser);
+    else
+        reparse(instance);
+    if (!instance->tree) {
+        yeast_instance_destroy(instance);
+        return NULL;
+    }
+    link_instance(instance);
+    return instance;
+}
+
+intmax_t yeast_instance_position(yeast_instance *instance, uint32_t byte)
+{
+    return 1 + yeast_offsets_char(&instance->offsets, &instance->text, byte);
+}
+
+emacs_value yeast_instance_range(emacs_env *env, yeast_instance *instance, uint32_t start, uint32_t end)
+{
+    return em_cons(
+        env,
+        env->make_integer(env, yeast_instance_position(instance, start)),
+        env->make_integer(env, yeast_instance_position(instance, end))
+    );
+}
+
+uint32_t yeast_instance_byte(yeast_instance *instance, intmax_t position)
+{
+    if (position < 1)
+        return 0;
+    return yeast_offsets_byte(&instance->offsets, &instance->text, position - 1);
 }
 
 YEAST_DOC(parse, "INSTANCE",
           "Parse the current buffer, overriding the current tree in INSTANCE.\n\n"
-          "Return non-nil if successful.");
+          "The whole buffer is copied into INSTANCE, subsequent edits only update\n"
+          "that copy. Return non-nil if successful.\n\n"
+          "If INSTANCE has a time budget, the parse may not be finished on return,\n"
+          "see `yeast--set-budget'.");
 emacs_value yeast_parse(emacs_env *env, emacs_value _instance)
 {
     YEAST_ASSERT_INSTANCE(_instance);
     yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
-    return reparse(env, instance);
+    return refill(env, instance);
 }
 
 YEAST_DOC(edit, "INSTANCE BEG END LEN",
-          "Re-parse the current buffer, overriding the current tree in INSTANCE.\n\n"
-          "BEG END and LEN are zero-based byte indexes of the recent change,\n"
-          "corresponding to `after-change-functions'.");
+          "Record a change in the current buffer in INSTANCE.\n\n"
+          "Only the changed region is read from the buffer, the rest of the text\n"
+          "is taken from the copy kept by INSTANCE. The tree is not re-parsed until\n"
+          "it is needed, or until `yeast--flush' is called.\n"
+          "BEG END and LEN are the buffer positions and the length of the replaced\n"
+          "text in characters, as passed to `after-change-functions'.");
 emacs_value yeast_edit(
     emacs_env *env, emacs_value _instance,
     emacs_value _beg, emacs_value _end, emacs_value _len)
@@ -146,12 +730,289 @@ emacs_value yeast_edit(
     YEAST_ASSERT_INTEGER(_len);
 
     yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
-    uint32_t start = YEAST_EXTRACT_INTEGER(_beg);
-    uint32_t old_end = start + YEAST_EXTRACT_INTEGER(_len);
-    uint32_t new_end = YEAST_EXTRACT_INTEGER(_end);
+    intmax_t beg = YEAST_EXTRACT_INTEGER(_beg);
+    intmax_t end = YEAST_EXTRACT_INTEGER(_end);
+    intmax_t len = YEAST_EXTRACT_INTEGER(_len);
+
+    // The text mirror still holds the old text, so it tells us where the
+    // replaced region ended. If it's not long enough, it can't be trusted.
+    uint32_t start = yeast_instance_byte(instance, beg);
+    uint32_t old_end = yeast_instance_byte(instance, beg + len);
+    if (end < beg || len < 0 || yeast_instance_position(instance, old_end) != beg + len)
+        return refill(env, instance);
+    TSPoint start_point = yeast_lines_point(&instance->lines, start);
+    TSPoint old_end_point = yeast_lines_point(&instance->lines, old_end);
+
+    // Update the text mirror with the new contents of the changed region.
+    // If that fails, start over.
+    int64_t inserted = fetch(env, instance, start, old_end, beg, end);
+    if (inserted < 0)
+        return refill(env, instance);
+    uint32_t new_end = start + inserted;
+    TSPoint new_end_point = yeast_lines_point(&instance->lines, new_end);
+
+    TSInputEdit edit = {start, old_end, new_end, start_point, old_end_point, new_end_point};
+    enqueue(instance, edit);
+    yeast_changes_edit(&instance->changes, start, old_end, new_end);
+    return em_t;
+}
+
+YEAST_DOC(flush, "INSTANCE",
+          "Re-parse INSTANCE if there are pending edits.\n\n"
+          "Return the number of edits merged into the parse.");
+emacs_value yeast_flush(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    return env->make_integer(env, yeast_instance_flush(instance));
+}
+
+/**
+ * Make a property list of parse and handle counters, common to
+ * `yeast--instance-stats' and `yeast--global-stats'.
+ * Times are converted to microseconds.
+ */
+static emacs_value stats(
+    emacs_env *env, const yeast_parse_counts *counts,
+    const yeast_handle_counts *handles, uint64_t pending, emacs_value tail)
+{
+    emacs_value args[] = {
+        env->intern(env, ":parses"), env->make_integer(env, counts->parses),
+        env->intern(env, ":edits"), env->make_integer(env, counts->edits),
+        env->intern(env, ":max-merged"), env->make_integer(env, counts->max_merged),
+        env->intern(env, ":pending"), env->make_integer(env, pending),
+        env->intern(env, ":parse-time"), env->make_integer(env, counts->parse_time / 1000),
+        env->intern(env, ":max-parse-time"), env->make_integer(env, counts->max_parse_time / 1000),
+        env->intern(env, ":reads"), env->make_integer(env, counts->reads),
+        env->intern(env, ":bytes-read"), env->make_integer(env, counts->bytes_read),
+        env->intern(env, ":trees"), env->make_integer(env, handles->trees),
+        env->intern(env, ":live-trees"), env->make_integer(env, handles->live_trees),
+        env->intern(env, ":nodes"), env->make_integer(env, handles->nodes),
+        env->intern(env, ":live-nodes"), env->make_integer(env, handles->live_nodes)
+    };
+    emacs_value retval = tail;
+    for (size_t i = sizeof(args) / sizeof(args[0]); i > 0; i--)
+        retval = em_cons(env, args[i - 1], retval);
+    return retval;
+}
+
+YEAST_DOC(instance_stats, "INSTANCE",
+          "Get counters for INSTANCE as a property list.\n\n"
+          "The properties are :parses (number of parses), :edits (number of edits\n"
+          "merged into parses), :last-merged and :max-merged (number of edits merged\n"
+          "into the last parse and the largest such number), :pending (number of\n"
+          "edits waiting for the next parse), :parse-time and :max-parse-time (total\n"
+          "time spent parsing and the longest time the parser ran at once, in\n"
+          "microseconds), :reads and :bytes-read (number of chunks of text read by\n"
+          "the parser and their total size), :trees and :nodes (number of trees and\n"
+          "nodes handed out), and :live-trees and :live-nodes (number of those that\n"
+          "were not garbage collected yet).");
+emacs_value yeast_instance_stats(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    yeast_parse_counts *counts = &instance->counts;
+
+    emacs_value tail = em_cons(env, env->intern(env, ":last-merged"),
+                               em_cons(env, env->make_integer(env, counts->last_merged), em_nil));
+    return stats(env, counts, &instance->handles, instance->queue.count, tail);
+}
+
+YEAST_DOC(global_stats, "",
+          "Get counters for all live instances as a property list.\n\n"
+          "The properties are :instances (number of live instances), and those of\n"
+          "`yeast--instance-stats' except :last-merged, summed over the live\n"
+          "instances. :max-merged and :max-parse-time are the largest among them.\n"
+          "Instances that were garbage collected are not counted.");
+emacs_value yeast_global_stats(emacs_env *env)
+{
+    yeast_parse_counts counts = {0};
+    yeast_handle_counts handles = {0};
+    uint64_t pending = 0, ninstances = 0;
+
+    // Counters are only updated on the main thread, the lock keeps instances alive
+    pthread_mutex_lock(&instances_lock);
+    for (yeast_instance *instance = instances; instance; instance = instance->next) {
+        const yeast_parse_counts *c = &instance->counts;
+        const yeast_handle_counts *h = &instance->handles;
+        counts.parses += c->parses;
+        counts.edits += c->edits;
+        if (c->max_merged > counts.max_merged)
+            counts.max_merged = c->max_merged;
+        counts.parse_time += c->parse_time;
+        if (c->max_parse_time > counts.max_parse_time)
+            counts.max_parse_time = c->max_parse_time;
+        counts.reads += c->reads;
+        counts.bytes_read += c->bytes_read;
+        handles.trees += h->trees;
+        handles.live_trees += h->live_trees;
+        handles.nodes += h->nodes;
+        handles.live_nodes += h->live_nodes;
+        pending += instance->queue.count;
+        ninstances++;
+    }
+    pthread_mutex_unlock(&instances_lock);
+
+    return em_cons(env, env->intern(env, ":instances"),
+                   em_cons(env, env->make_integer(env, ninstances),
+                           stats(env, &counts, &handles, pending, em_nil)));
+}
+
+YEAST_DOC(parser_stats, "",
+          "Get counters for the parser pools of all languages as a property list.\n\n"
+          "The properties are :created (number of parsers created), :live (number\n"
+          "of parsers in existence) and :idle (number of live parsers in a pool).\n"
+          "Parsers are only borrowed by instances while parsing, so :live minus\n"
+          ":idle is the number of parses running.");
+emacs_value yeast_parser_stats(emacs_env *env)
+{
+    yeast_parser_counts counts = yeast_language_parser_counts();
+    emacs_value args[] = {
+        env->intern(env, ":created"), env->make_integer(env, counts.created),
+        env->intern(env, ":live"), env->make_integer(env, counts.live),
+        env->intern(env, ":idle"), env->make_integer(env, counts.idle)
+    };
+    return em_list(env, sizeof(args) / sizeof(args[0]), args);
+}
+
+YEAST_DOC(set_async, "INSTANCE FLAG",
+          "Enable asynchronous parsing in INSTANCE if FLAG is non-nil, or disable it.\n\n"
+          "In asynchronous mode, accessing the tree of INSTANCE starts a parse of\n"
+          "pending edits in a background thread, and returns the previous tree\n"
+          "until the new one is published by `yeast--poll'.");
+emacs_value yeast_set_async(emacs_env *env, emacs_value _instance, emacs_value _flag)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    instance->async = YEAST_EXTRACT_BOOLEAN(_flag);
+    if (!instance->async)
+        wait_job(instance);
+    return em_nil;
+}
+
+YEAST_DOC(parse_async, "INSTANCE",
+          "Start parsing the pending edits in INSTANCE in a background thread.\n\n"
+          "Return non-nil if a parse was started. Nothing happens if there are no\n"
+          "pending edits, or if a parse is already running.");
+emacs_value yeast_parse_async(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    return yeast_instance_start(instance) ? em_t : em_nil;
+}
+
+YEAST_DOC(poll, "INSTANCE",
+          "Publish the result of a finished background parse in INSTANCE.\n\n"
+          "Return non-nil if a new tree was published.");
+emacs_value yeast_poll(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    return yeast_instance_poll(instance) ? em_t : em_nil;
+}
+
+YEAST_DOC(parsing_p, "INSTANCE",
+          "Return non-nil if INSTANCE has a parse that is not yet published.\n\n"
+          "This is either a background parse, or a parse that ran out of time.");
+emacs_value yeast_parsing_p(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    return instance->job || instance->resume.parser ? em_t : em_nil;
+}
+
+YEAST_DOC(set_budget, "INSTANCE BUDGET",
+          "Limit the time spent parsing INSTANCE at once to BUDGET microseconds.\n\n"
+          "If BUDGET is nil or zero, parses run to completion. Otherwise, a parse\n"
+          "that runs out of time is suspended, and the previous tree is served\n"
+          "to readers until it's finished by `yeast--parse-step'.");
+emacs_value yeast_set_budget(emacs_env *env, emacs_value _instance, emacs_value _budget)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    intmax_t budget = 0;
+    if (YEAST_EXTRACT_BOOLEAN(_budget)) {
+        YEAST_ASSERT_INTEGER(_budget);
+        budget = YEAST_EXTRACT_INTEGER(_budget);
+    }
+    instance->budget = budget < 0 ? 0 : budget;
+    return em_nil;
+}
+
+YEAST_DOC(parse_step, "INSTANCE &optional BUDGET",
+          "Parse the pending edits in INSTANCE for at most BUDGET microseconds.\n\n"
+          "BUDGET defaults to the time budget of INSTANCE. A parse that ran out\n"
+          "of time earlier is resumed where it stopped, unless the text changed\n"
+          "in the meantime. Return non-nil if the tree of INSTANCE is up to date.");
+emacs_value yeast_parse_step(emacs_env *env, emacs_value _instance, emacs_value _budget)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    uint64_t budget = instance->budget;
+    if (YEAST_EXTRACT_BOOLEAN(_budget)) {
+        YEAST_ASSERT_INTEGER(_budget);
+        intmax_t value = YEAST_EXTRACT_INTEGER(_budget);
+        budget = value < 0 ? 0 : value;
+    }
+    return yeast_instance_step(instance, budget) ? em_t : em_nil;
+}
 
-    TSInputEdit edit = {start, old_end, new_end, {0, 0}, {0, 0}};
-    ts_tree_edit(instance->tree, &edit);
+YEAST_DOC(changed_ranges, "INSTANCE &optional SINCE",
+          "Get the ranges of INSTANCE whose structure changed in parses after SINCE.\n\n"
+          "SINCE is a generation number as returned by this function, or nil for\n"
+          "zero. Return (GENERATION . RANGES), where GENERATION is that of the\n"
+          "current tree and RANGES is a list of (BEG . END) in the current text,\n"
+          "oldest first. RANGES is t if that history is no longer available,\n"
+          "in which case everything should be assumed to have changed.\n\n"
+          "This does not parse pending edits.");
+emacs_value yeast_changed_ranges(emacs_env *env, emacs_value _instance, emacs_value _since)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    uint64_t since = 0;
+    if (YEAST_EXTRACT_BOOLEAN(_since)) {
+        YEAST_ASSERT_INTEGER(_since);
+        intmax_t value = YEAST_EXTRACT_INTEGER(_since);
+        since = value < 0 ? 0 : value;
+    }
+
+    emacs_value generation = env->make_integer(env, instance->generation);
+    yeast_changes *changes = &instance->changes;
+    if (since < changes->floor)
+        return em_cons(env, generation, em_t);
+
+    emacs_value ranges = em_nil;
+    for (uint32_t i = changes->length; i > 0; i--) {
+        const yeast_change *change = yeast_changes_get(changes, i - 1);
+        if (change->generation <= since)
+            break;
+        emacs_value range = yeast_instance_range(env, instance, change->start, change->end);
+        ranges = em_cons(env, range, ranges);
+    }
+    return em_cons(env, generation, ranges);
+}
+
+YEAST_DOC(line_count, "INSTANCE", "Get the number of lines in the text of INSTANCE.");
+emacs_value yeast_line_count(emacs_env *env, emacs_value _instance)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    return env->make_integer(env, yeast_lines_count(&instance->lines));
+}
+
+YEAST_DOC(line_position, "INSTANCE LINE",
+          "Get the buffer position where LINE starts in the text of INSTANCE.\n\n"
+          "LINE is one-based. Return nil if there is no such line.");
+emacs_value yeast_line_position(emacs_env *env, emacs_value _instance, emacs_value _line)
+{
+    YEAST_ASSERT_INSTANCE(_instance);
+    YEAST_ASSERT_INTEGER(_line);
+
+    yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    intmax_t line = YEAST_EXTRACT_INTEGER(_line);
+    if (line < 1 || line > yeast_lines_count(&instance->lines))
+        return em_nil;
 
-    return reparse(env, instance);
+    uint32_t byte = yeast_lines_start(&instance->lines, line - 1);
+    return env->make_integer(env, yeast_instance_position(instance, byte));
 }
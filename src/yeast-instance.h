@@ -5,8 +5,114 @@
 
 YEAST_DEFUN(make_instance, emacs_value language);
 YEAST_DEFUN(instance_p, emacs_value obj);
+YEAST_DEFUN(register_language, emacs_value _name, emacs_value _path, emacs_value _function);
+YEAST_DEFUN(language_types, emacs_value language, emacs_value kind);
 
 YEAST_DEFUN(parse, emacs_value _instance);
 YEAST_DEFUN(edit, emacs_value _instance, emacs_value _beg, emacs_value _end, emacs_value _len);
+YEAST_DEFUN(flush, emacs_value _instance);
+YEAST_DEFUN(instance_stats, emacs_value _instance);
+YEAST_DEFUN_0(parser_stats);
+YEAST_DEFUN_0(global_stats);
+
+YEAST_DEFUN(set_async, emacs_value _instance, emacs_value _flag);
+YEAST_DEFUN(parse_async, emacs_value _instance);
+YEAST_DEFUN(poll, emacs_value _instance);
+YEAST_DEFUN(parsing_p, emacs_value _instance);
+
+YEAST_DEFUN(set_budget, emacs_value _instance, emacs_value _budget);
+YEAST_DEFUN(parse_step, emacs_value _instance, emacs_value _budget);
+
+YEAST_DEFUN(changed_ranges, emacs_value _instance, emacs_value _since);
+
+YEAST_DEFUN(line_count, emacs_value _instance);
+YEAST_DEFUN(line_position, emacs_value _instance, emacs_value _line);
+
+/**
+ * Re-parse an instance if it has pending edits.
+ * @param instance The instance.
+ * @return The number of edits merged into the parse.
+ */
+uint32_t yeast_instance_flush(yeast_instance *instance);
+
+/**
+ * Start parsing the pending edits of an instance in a background thread.
+ * @param instance The instance.
+ * @return True iff a parse was started.
+ */
+bool yeast_instance_start(yeast_instance *instance);
+
+/**
+ * Publish the result of a finished background parse.
+ * @param instance The instance.
+ * @return True iff a new tree was published.
+ */
+bool yeast_instance_poll(yeast_instance *instance);
+
+/**
+ * Parse the pending edits of an instance for a limited time.
+ * A parse that ran out of time is resumed by the next call, unless edits came
+ * in meanwhile, in which case it starts over with them. The tree of the
+ * instance is only replaced once the parse is finished.
+ * @param instance The instance.
+ * @param budget The time limit in microseconds, or zero for none.
+ * @return True iff the tree is up to date.
+ */
+bool yeast_instance_step(yeast_instance *instance, uint64_t budget);
+
+/**
+ * Bring the tree of an instance up to date before it's read.
+ * In synchronous mode this is the same as yeast_instance_flush. In asynchronous
+ * mode, finished parses are published and new ones started without waiting.
+ * With a time budget, this parses for at most that long.
+ * @param instance The instance.
+ */
+void yeast_instance_update(yeast_instance *instance);
+
+/**
+ * Free an instance and everything it owns.
+ * Should only be called when the reference count has reached zero.
+ * @param instance The instance.
+ */
+void yeast_instance_destroy(yeast_instance *instance);
+
+/**
+ * Make an instance that holds a parsed text, such as a file mapped into memory.
+ * Such an instance is not attached to any buffer and is never edited.
+ * This never calls back into Emacs.
+ * @param language The language of the text.
+ * @param text The text, which is moved into the instance (or freed on failure)
+ *   and left empty.
+ * @param parser A parser for LANGUAGE, or NULL to borrow one from its pool.
+ * @return The instance with a reference count of one, or NULL if the text
+ *   can't be parsed.
+ */
+yeast_instance *yeast_instance_from_text(yeast_language *language, yeast_text *text, TSParser *parser);
+
+/**
+ * Convert a byte offset in the text of an instance to a buffer position.
+ * @param instance The instance.
+ * @param byte The byte offset (zero-based).
+ * @return The buffer position (one-based).
+ */
+intmax_t yeast_instance_position(yeast_instance *instance, uint32_t byte);
+
+/**
+ * Convert a byte range in the text of an instance to a cons cell of buffer positions.
+ * @param env The active Emacs environment.
+ * @param instance The instance.
+ * @param start The starting byte offset (zero-based).
+ * @param end The ending byte offset (zero-based).
+ * @return The cons cell (BEG . END).
+ */
+emacs_value yeast_instance_range(emacs_env *env, yeast_instance *instance, uint32_t start, uint32_t end);
+
+/**
+ * Convert a buffer position to a byte offset in the text of an instance.
+ * @param instance The instance.
+ * @param position The buffer position (one-based).
+ * @return The byte offset (zero-based).
+ */
+uint32_t yeast_instance_byte(yeast_instance *instance, intmax_t position);
 
 #endif /* YEAST_INSTANCE_H */
@@ -0,0 +1,257 @@
+// Needed for dladdr
+#define _GNU_SOURCE
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree_sitter/runtime.h"
+#include "uthash.h"
+
+#include "interface.h"
+#include "yeast-language.h"
+
+// Oldest grammar ABI version the runtime can parse with
+#ifdef TREE_SITTER_MIN_COMPATIBLE_LANGUAGE_VERSION
+#define MIN_LANGUAGE_VERSION TREE_SITTER_MIN_COMPATIBLE_LANGUAGE_VERSION
+#else
+#define MIN_LANGUAGE_VERSION TREE_SITTER_LANGUAGE_VERSION
+#endif
+
+// Suffix of the grammar shared objects built alongside the module
+#ifndef YEAST_GRAMMAR_SUFFIX
+#define YEAST_GRAMMAR_SUFFIX ".so"
+#endif
+
+static const char *builtin[] = {
+    "bash", "c", "cpp", "css", "go", "html", "javascript",
+    "json", "ocaml", "php", "python", "ruby", "rust", "typescript",
+};
+
+// The registry of languages, keyed by name
+static yeast_language *languages = NULL;
+
+// Parser counters, shared by all languages
+static uint64_t parsers_created = 0, parsers_live = 0;
+
+void yeast_language_init(void)
+{
+    // The built-in grammars live in the same directory as this module
+    Dl_info info;
+    const char *dir = ".";
+    size_t dirlen = 1;
+    if (dladdr((void*) yeast_language_init, &info) && info.dli_fname) {
+        const char *slash = strrchr(info.dli_fname, '/');
+        if (slash) {
+            dir = info.dli_fname;
+            dirlen = slash - info.dli_fname;
+        }
+    }
+
+    for (size_t i = 0; i < sizeof(builtin) / sizeof(const char*); i++) {
+        char path[4096];
+        snprintf(path, sizeof(path), "%.*s/libyeast-%s" YEAST_GRAMMAR_SUFFIX,
+                 (int) dirlen, dir, builtin[i]);
+        yeast_language_register(builtin[i], path, NULL);
+    }
+}
+
+bool yeast_language_register(const char *name, const char *path, const char *function)
+{
+    char buf[256];
+    if (!function) {
+        snprintf(buf, sizeof(buf), "tree_sitter_%s", name);
+        function = buf;
+    }
+
+    yeast_language *language;
+    HASH_FIND_STR(languages, name, language);
+    if (language && language->handle)
+        return false;
+
+    char *new_path = strdup(path), *new_function = strdup(function);
+    if (!new_path || !new_function) {
+        free(new_path);
+        free(new_function);
+        return false;
+    }
+
+    if (language) {
+        free(language->path);
+        free(language->function);
+        language->path = new_path;
+        language->function = new_function;
+        return true;
+    }
+
+    language = (yeast_language*) calloc(1, sizeof(yeast_language));
+    if (!language || !(language->name = strdup(name))) {
+        free(language);
+        free(new_path);
+        free(new_function);
+        return false;
+    }
+    language->path = new_path;
+    language->function = new_function;
+    pthread_mutex_init(&language->lock, NULL);
+    HASH_ADD_KEYPTR(hh, languages, language->name, strlen(language->name), language);
+    return true;
+}
+
+/**
+ * Load the grammar of a language, and check that the runtime can use it.
+ * Grammars are never unloaded, since trees may refer to them.
+ */
+static bool load(emacs_env *env, yeast_language *language)
+{
+    char message[4096];
+
+    void *handle = dlopen(language->path, RTLD_NOW | RTLD_LOCAL);
+    if (!handle) {
+        snprintf(message, sizeof(message), "could not load grammar: %s", dlerror());
+        em_signal_error(env, message);
+        return false;
+    }
+
+    const TSLanguage *(*function)(void) = (const TSLanguage *(*)(void)) dlsym(handle, language->function);
+    if (!function) {
+        snprintf(message, sizeof(message), "could not find %s in %s",
+                 language->function, language->path);
+        em_signal_error(env, message);
+        dlclose(handle);
+        return false;
+    }
+
+    const TSLanguage *ts_language = function();
+    if (!ts_language) {
+        snprintf(message, sizeof(message), "%s in %s returned no language",
+                 language->function, language->path);
+        em_signal_error(env, message);
+        dlclose(handle);
+        return false;
+    }
+
+    // Parsers refuse grammars of another ABI version
+    uint32_t version = ts_language_version(ts_language);
+    if (version < MIN_LANGUAGE_VERSION || version > TREE_SITTER_LANGUAGE_VERSION) {
+        if (MIN_LANGUAGE_VERSION == TREE_SITTER_LANGUAGE_VERSION)
+            snprintf(message, sizeof(message),
+                     "grammar %s has ABI version %u, but the runtime requires version %u",
+                     language->path, version, TREE_SITTER_LANGUAGE_VERSION);
+        else
+            snprintf(message, sizeof(message),
+                     "grammar %s has ABI version %u, but the runtime requires versions %u to %u",
+                     language->path, version, MIN_LANGUAGE_VERSION, TREE_SITTER_LANGUAGE_VERSION);
+        em_signal_error(env, message);
+        dlclose(handle);
+        return false;
+    }
+
+    language->handle = handle;
+    language->language = ts_language;
+    return true;
+}
+
+yeast_language *yeast_language_find(emacs_env *env, emacs_value name)
+{
+    char *str = em_symbol_name(env, name);
+    yeast_language *language;
+    HASH_FIND_STR(languages, str, language);
+    free(str);
+
+    if (!language) {
+        env->non_local_exit_signal(env, em_unknown_language, em_cons(env, name, em_nil));
+        return NULL;
+    }
+    if (!language->handle && !load(env, language))
+        return NULL;
+    return language;
+}
+
+TSParser *yeast_language_acquire(yeast_language *language)
+{
+    TSParser *parser = NULL;
+    pthread_mutex_lock(&language->lock);
+    if (language->nparsers > 0)
+        parser = language->parsers[--language->nparsers];
+    pthread_mutex_unlock(&language->lock);
+    if (parser)
+        return parser;
+
+    parser = ts_parser_new();
+    if (!parser)
+        return NULL;
+    if (!ts_parser_set_language(parser, language->language)) {
+        ts_parser_delete(parser);
+        return NULL;
+    }
+    __atomic_add_fetch(&parsers_created, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&parsers_live, 1, __ATOMIC_RELAXED);
+    return parser;
+}
+
+void yeast_language_release(yeast_language *language, TSParser *parser)
+{
+    pthread_mutex_lock(&language->lock);
+    bool pooled = language->nparsers < YEAST_POOL_SIZE;
+    if (pooled)
+        language->parsers[language->nparsers++] = parser;
+    pthread_mutex_unlock(&language->lock);
+
+    if (!pooled) {
+        ts_parser_delete(parser);
+        __atomic_sub_fetch(&parsers_live, 1, __ATOMIC_RELAXED);
+    }
+}
+
+yeast_parser_counts yeast_language_parser_counts(void)
+{
+    yeast_parser_counts counts = {
+        __atomic_load_n(&parsers_created, __ATOMIC_RELAXED),
+        __atomic_load_n(&parsers_live, __ATOMIC_RELAXED),
+        0
+    };
+
+    yeast_language *language, *tmp;
+    HASH_ITER(hh, languages, language, tmp) {
+        pthread_mutex_lock(&language->lock);
+        counts.idle += language->nparsers;
+        pthread_mutex_unlock(&language->lock);
+    }
+    return counts;
+}
+
+/**
+ * Intern the type symbols of all grammar symbols of a language.
+ * These are kept as global references, so they're never freed.
+ */
+static bool load_types(emacs_env *env, yeast_language *language)
+{
+    uint32_t ntypes = ts_language_symbol_count(language->language);
+    emacs_value *types = (emacs_value*) malloc(ntypes * sizeof(emacs_value));
+    if (!types)
+        return false;
+
+    for (uint32_t i = 0; i < ntypes; i++) {
+        const char *name = ts_language_symbol_name(language->language, (TSSymbol) i);
+        types[i] = env->make_global_ref(env, env->intern(env, name));
+    }
+
+    language->types = types;
+    language->ntypes = ntypes;
+    return true;
+}
+
+emacs_value yeast_language_type(emacs_env *env, yeast_language *language, TSSymbol symbol)
+{
+    if (!language->types)
+        load_types(env, language);
+    if (symbol < language->ntypes)
+        return language->types[symbol];
+
+    // Builtin symbols such as ERROR are not part of the table
+    const char *name = ts_language_symbol_name(language->language, symbol);
+    return env->intern(env, name);
+}
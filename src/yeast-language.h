@@ -0,0 +1,108 @@
+#include <pthread.h>
+#include <stdint.h>
+
+#include "emacs-module.h"
+#include "tree_sitter/runtime.h"
+#include "uthash.h"
+
+#ifndef YEAST_LANGUAGE_H
+#define YEAST_LANGUAGE_H
+
+/**
+ * Maximal number of idle parsers kept for each language.
+ */
+#define YEAST_POOL_SIZE 4
+
+/**
+ * A language known to yeast, keyed by NAME in the registry.
+ * The grammar is a shared object at PATH, which is only loaded the first time
+ * the language is used. FUNCTION is the name of the function in the shared
+ * object that returns the language.
+ * TYPES holds global references to the node type symbols, indexed by grammar
+ * symbol id. It is filled in the first time a type is requested.
+ * PARSERS is a pool of idle parsers for the language. Instances borrow a
+ * parser only while parsing, possibly from a background thread, so the pool
+ * is protected by LOCK.
+ */
+typedef struct {
+    char *name;
+    char *path;
+    char *function;
+    void *handle;
+    const TSLanguage *language;
+    emacs_value *types;
+    uint32_t ntypes;
+    pthread_mutex_t lock;
+    TSParser *parsers[YEAST_POOL_SIZE];
+    uint32_t nparsers;
+    UT_hash_handle hh;
+} yeast_language;
+
+/**
+ * Counters for the parsers of all languages.
+ */
+typedef struct {
+    uint64_t created;
+    uint64_t live;
+    uint64_t idle;
+} yeast_parser_counts;
+
+/**
+ * Register the built-in languages.
+ * Their grammars are expected next to the module itself.
+ * This function should only be called once.
+ */
+void yeast_language_init(void);
+
+/**
+ * Register a language, or change the grammar of a language that isn't loaded yet.
+ * @param name The name of the language.
+ * @param path The path of the shared object holding the grammar.
+ * @param function The name of the function returning the language, or NULL
+ *        to use tree_sitter_NAME.
+ * @return False if the language is already loaded, or out of memory.
+ */
+bool yeast_language_register(const char *name, const char *path, const char *function);
+
+/**
+ * Find a language by name, loading its grammar if necessary.
+ * Signals an error if the language is unknown or can't be loaded.
+ * @param env The active Emacs environment.
+ * @param name The language symbol.
+ * @return The language, or NULL if an error was signaled.
+ */
+yeast_language *yeast_language_find(emacs_env *env, emacs_value name);
+
+/**
+ * Borrow a parser for a language.
+ * This is safe to call from any thread.
+ * @param language The language, which must be loaded.
+ * @return The parser, or NULL if out of memory or if the runtime rejects the grammar.
+ */
+TSParser *yeast_language_acquire(yeast_language *language);
+
+/**
+ * Return a borrowed parser to the pool of its language.
+ * The parser is deleted if the pool is full.
+ * This is safe to call from any thread.
+ * @param language The language.
+ * @param parser The parser.
+ */
+void yeast_language_release(yeast_language *language, TSParser *parser);
+
+/**
+ * Get the parser counters of all languages.
+ * @return The counters.
+ */
+yeast_parser_counts yeast_language_parser_counts(void);
+
+/**
+ * Get the type symbol of a grammar symbol.
+ * @param env The active Emacs environment.
+ * @param language The language, which must be loaded.
+ * @param symbol The grammar symbol id.
+ * @return The interned type symbol.
+ */
+emacs_value yeast_language_type(emacs_env *env, yeast_language *language, TSSymbol symbol);
+
+#endif /* YEAST_LANGUAGE_H */
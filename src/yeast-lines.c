@@ -0,0 +1,141 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "yeast-lines.h"
+
+// The start of the first line is always zero, and is not stored in the table.
+// Stored entry I is the start of line I + 1.
+
+/**
+ * Get the number of stored entries.
+ */
+static uint32_t nstored(const yeast_lines *lines)
+{
+    return lines->gap_start + (lines->size - lines->gap_end);
+}
+
+/**
+ * Get the value of a stored entry.
+ */
+static uint32_t get(const yeast_lines *lines, uint32_t i)
+{
+    if (i < lines->gap_start)
+        return lines->starts[i];
+    return lines->length - lines->starts[i - lines->gap_start + lines->gap_end];
+}
+
+/**
+ * Count the stored entries not exceeding a byte offset.
+ */
+static uint32_t count_until(const yeast_lines *lines, uint32_t byte)
+{
+    uint32_t lo = 0, hi = nstored(lines);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (get(lines, mid) <= byte)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Move the gap so that it starts at a given entry.
+ */
+static void move_gap(yeast_lines *lines, uint32_t k)
+{
+    while (lines->gap_start > k) {
+        lines->gap_start--;
+        lines->gap_end--;
+        lines->starts[lines->gap_end] = lines->length - lines->starts[lines->gap_start];
+    }
+    while (lines->gap_start < k) {
+        lines->starts[lines->gap_start] = lines->length - lines->starts[lines->gap_end];
+        lines->gap_start++;
+        lines->gap_end++;
+    }
+}
+
+/**
+ * Insert an entry at the start of the gap.
+ */
+static bool insert(yeast_lines *lines, uint32_t value)
+{
+    if (lines->gap_start == lines->gap_end) {
+        uint32_t tail = lines->size - lines->gap_end;
+        uint32_t size = lines->size ? 2 * lines->size : 256;
+        uint32_t *starts = (uint32_t*) realloc(lines->starts, size * sizeof(uint32_t));
+        if (!starts)
+            return false;
+        memmove(starts + size - tail, starts + lines->gap_end, tail * sizeof(uint32_t));
+        lines->starts = starts;
+        lines->gap_end = size - tail;
+        lines->size = size;
+    }
+
+    lines->starts[lines->gap_start++] = value;
+    return true;
+}
+
+void yeast_lines_init(yeast_lines *lines)
+{
+    *lines = (yeast_lines) {NULL, 0, 0, 0, 0};
+}
+
+void yeast_lines_free(yeast_lines *lines)
+{
+    free(lines->starts);
+    yeast_lines_init(lines);
+}
+
+bool yeast_lines_edit(yeast_lines *lines, const yeast_text *text,
+                      uint32_t start, uint32_t old_end, uint32_t new_end)
+{
+    // Lines starting at or before START are unaffected
+    move_gap(lines, count_until(lines, start));
+
+    // Delete lines whose preceding newline was replaced
+    while (lines->gap_end < lines->size && lines->length - lines->starts[lines->gap_end] <= old_end)
+        lines->gap_end++;
+
+    // Entries after the gap are relative to the end, so they move with it
+    lines->length = lines->length - old_end + new_end;
+
+    // Insert lines whose preceding newline was inserted
+    uint32_t offset = start;
+    while (offset < new_end) {
+        uint32_t nbytes;
+        const char *chunk = yeast_text_chunk(text, offset, &nbytes);
+        if (nbytes == 0)
+            break;
+        if (nbytes > new_end - offset)
+            nbytes = new_end - offset;
+
+        const char *p = chunk, *end = chunk + nbytes;
+        while ((p = memchr(p, '\n', end - p))) {
+            p++;
+            if (!insert(lines, offset + (p - chunk)))
+                return false;
+        }
+        offset += nbytes;
+    }
+
+    return true;
+}
+
+uint32_t yeast_lines_count(const yeast_lines *lines)
+{
+    return 1 + nstored(lines);
+}
+
+uint32_t yeast_lines_start(const yeast_lines *lines, uint32_t row)
+{
+    return row == 0 ? 0 : get(lines, row - 1);
+}
+
+TSPoint yeast_lines_point(const yeast_lines *lines, uint32_t byte)
+{
+    uint32_t row = count_until(lines, byte);
+    return (TSPoint) {row, byte - yeast_lines_start(lines, row)};
+}
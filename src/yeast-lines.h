@@ -0,0 +1,71 @@
+#include <stdint.h>
+
+#include "tree_sitter/runtime.h"
+
+#include "yeast-text.h"
+
+#ifndef YEAST_LINES_H
+#define YEAST_LINES_H
+
+/**
+ * Table of the byte offsets where lines start in a text.
+ * Like the text itself, the table is a gap buffer. Entries before the gap are
+ * absolute offsets, and entries after the gap are stored as the distance to the
+ * end of the text, so that edits don't need to shift the rest of the table.
+ */
+typedef struct {
+    uint32_t *starts;
+    uint32_t size;
+    uint32_t gap_start;
+    uint32_t gap_end;
+    uint32_t length;
+} yeast_lines;
+
+/**
+ * Initialize a line table for an empty text.
+ * @param lines The table to initialize.
+ */
+void yeast_lines_init(yeast_lines *lines);
+
+/**
+ * Release the memory held by a line table.
+ * @param lines The table to free.
+ */
+void yeast_lines_free(yeast_lines *lines);
+
+/**
+ * Update a line table after an edit.
+ * @param lines The table.
+ * @param text The text, after the edit.
+ * @param start The first byte of the edit.
+ * @param old_end The end of the replaced text, in the old text.
+ * @param new_end The end of the replacement, in the new text.
+ * @return False if out of memory, in which case the table is invalid.
+ */
+bool yeast_lines_edit(yeast_lines *lines, const yeast_text *text,
+                      uint32_t start, uint32_t old_end, uint32_t new_end);
+
+/**
+ * Get the number of lines.
+ * @param lines The table.
+ * @return The number of lines (at least one).
+ */
+uint32_t yeast_lines_count(const yeast_lines *lines);
+
+/**
+ * Get the byte offset where a line starts.
+ * @param lines The table.
+ * @param row The line number (zero-based), which must be smaller than the number of lines.
+ * @return The byte offset.
+ */
+uint32_t yeast_lines_start(const yeast_lines *lines, uint32_t row);
+
+/**
+ * Get the row and column (in bytes) of a byte offset.
+ * @param lines The table.
+ * @param byte The byte offset.
+ * @return The point.
+ */
+TSPoint yeast_lines_point(const yeast_lines *lines, uint32_t byte);
+
+#endif /* YEAST_LINES_H */
@@ -0,0 +1,262 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "yeast-offsets.h"
+
+// Number of bytes between checkpoints
+#define STRIDE 1024
+
+// The high bit of every byte in a word
+#define HIGH_BITS 0x8080808080808080ULL
+
+/**
+ * Count the number of UTF-8 character starts (non-continuation bytes) in a chunk.
+ * Processes eight bytes at a time: a continuation byte has its high bit set
+ * and the next bit cleared.
+ */
+static uint32_t count_starts(const char *data, uint32_t nbytes)
+{
+    uint32_t count = nbytes;
+    uint32_t i = 0;
+
+    for (; i + 8 <= nbytes; i += 8) {
+        uint64_t word;
+        memcpy(&word, data + i, 8);
+        count -= __builtin_popcountll(word & ~(word << 1) & HIGH_BITS);
+    }
+    for (; i < nbytes; i++)
+        if (((unsigned char) data[i] & 0xc0) == 0x80)
+            count--;
+
+    return count;
+}
+
+/**
+ * Count the number of characters starting between two byte offsets.
+ */
+static uint32_t count_chars(const yeast_text *text, uint32_t from, uint32_t to)
+{
+    uint32_t count = 0;
+    while (from < to) {
+        uint32_t nbytes;
+        const char *chunk = yeast_text_chunk(text, from, &nbytes);
+        if (nbytes == 0)
+            break;
+        if (nbytes > to - from)
+            nbytes = to - from;
+        count += count_starts(chunk, nbytes);
+        from += nbytes;
+    }
+    return count;
+}
+
+/**
+ * Get the number of stored checkpoints.
+ */
+static uint32_t nstored(const yeast_offsets *offsets)
+{
+    return offsets->gap_start + (offsets->size - offsets->gap_end);
+}
+
+/**
+ * Get a stored checkpoint.
+ */
+static yeast_checkpoint get(const yeast_offsets *offsets, uint32_t i)
+{
+    if (i < offsets->gap_start)
+        return offsets->points[i];
+    yeast_checkpoint point = offsets->points[i - offsets->gap_start + offsets->gap_end];
+    return (yeast_checkpoint) {offsets->length - point.byte, offsets->nchars - point.chars};
+}
+
+/**
+ * Count the checkpoints not past a byte offset.
+ */
+static uint32_t count_until(const yeast_offsets *offsets, uint32_t byte)
+{
+    uint32_t lo = 0, hi = nstored(offsets);
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (get(offsets, mid).byte <= byte)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+/**
+ * Move the gap so that it starts at a given checkpoint.
+ */
+static void move_gap(yeast_offsets *offsets, uint32_t k)
+{
+    yeast_checkpoint *points = offsets->points;
+    while (offsets->gap_start > k) {
+        offsets->gap_start--;
+        offsets->gap_end--;
+        yeast_checkpoint point = points[offsets->gap_start];
+        points[offsets->gap_end] = (yeast_checkpoint) {
+            offsets->length - point.byte, offsets->nchars - point.chars
+        };
+    }
+    while (offsets->gap_start < k) {
+        yeast_checkpoint point = points[offsets->gap_end];
+        points[offsets->gap_start] = (yeast_checkpoint) {
+            offsets->length - point.byte, offsets->nchars - point.chars
+        };
+        offsets->gap_start++;
+        offsets->gap_end++;
+    }
+}
+
+/**
+ * Insert a checkpoint at the start of the gap.
+ */
+static bool insert(yeast_offsets *offsets, yeast_checkpoint point)
+{
+    if (offsets->gap_start == offsets->gap_end) {
+        uint32_t tail = offsets->size - offsets->gap_end;
+        uint32_t size = offsets->size ? 2 * offsets->size : 64;
+        yeast_checkpoint *points = (yeast_checkpoint*) realloc(offsets->points, size * sizeof(yeast_checkpoint));
+        if (!points)
+            return false;
+        memmove(points + size - tail, points + offsets->gap_end, tail * sizeof(yeast_checkpoint));
+        offsets->points = points;
+        offsets->gap_end = size - tail;
+        offsets->size = size;
+    }
+
+    offsets->points[offsets->gap_start++] = point;
+    return true;
+}
+
+/**
+ * Insert checkpoints every STRIDE bytes from FROM, until less than that is left
+ * before LIMIT. The gap must be right after FROM.
+ * @return The number of characters before LIMIT, or -1 if out of memory.
+ */
+static int64_t fill(yeast_offsets *offsets, const yeast_text *text, yeast_checkpoint from, uint32_t limit)
+{
+    while (limit - from.byte > STRIDE) {
+        from.chars += count_chars(text, from.byte, from.byte + STRIDE);
+        from.byte += STRIDE;
+        if (!insert(offsets, from))
+            return -1;
+    }
+    return from.chars + count_chars(text, from.byte, limit);
+}
+
+/**
+ * Build the index of a text from scratch, if it isn't built.
+ * @return False if out of memory.
+ */
+static bool build(yeast_offsets *offsets, const yeast_text *text)
+{
+    if (offsets->built)
+        return true;
+
+    offsets->gap_start = 0;
+    offsets->gap_end = offsets->size;
+    offsets->length = yeast_text_length(text);
+    yeast_checkpoint first = {0, 0};
+    if (!insert(offsets, first))
+        return false;
+    int64_t nchars = fill(offsets, text, first, offsets->length);
+    if (nchars < 0)
+        return false;
+
+    offsets->nchars = nchars;
+    offsets->built = true;
+    return true;
+}
+
+void yeast_offsets_init(yeast_offsets *offsets)
+{
+    *offsets = (yeast_offsets) {NULL, 0, 0, 0, 0, 0, false};
+}
+
+void yeast_offsets_free(yeast_offsets *offsets)
+{
+    free(offsets->points);
+    yeast_offsets_init(offsets);
+}
+
+void yeast_offsets_edit(yeast_offsets *offsets, const yeast_text *text,
+                        uint32_t start, uint32_t old_end, uint32_t new_end)
+{
+    if (!offsets->built)
+        return;
+
+    // Checkpoints at or before START are unaffected. There is always one at zero.
+    move_gap(offsets, count_until(offsets, start));
+
+    // Delete checkpoints within the replaced text
+    while (offsets->gap_end < offsets->size &&
+           offsets->length - offsets->points[offsets->gap_end].byte < old_end)
+        offsets->gap_end++;
+
+    // Checkpoints after the gap are relative to the end, so they move with it
+    offsets->length = offsets->length - old_end + new_end;
+
+    // Count again from the last checkpoint before the edit to the next one after it
+    bool tail = offsets->gap_end < offsets->size;
+    uint32_t limit = tail ? offsets->length - offsets->points[offsets->gap_end].byte : offsets->length;
+    int64_t chars = fill(offsets, text, offsets->points[offsets->gap_start - 1], limit);
+    if (chars < 0) {
+        // Rebuilt on next use
+        yeast_offsets_free(offsets);
+        return;
+    }
+    offsets->nchars = chars + (tail ? offsets->points[offsets->gap_end].chars : 0);
+}
+
+uint32_t yeast_offsets_char(yeast_offsets *offsets, const yeast_text *text, uint32_t byte)
+{
+    uint32_t length = yeast_text_length(text);
+    if (byte > length)
+        byte = length;
+
+    if (!build(offsets, text))
+        return count_chars(text, 0, byte);
+    yeast_checkpoint point = get(offsets, count_until(offsets, byte) - 1);
+    return point.chars + count_chars(text, point.byte, byte);
+}
+
+uint32_t yeast_offsets_byte(yeast_offsets *offsets, const yeast_text *text, uint32_t chr)
+{
+    uint32_t length = yeast_text_length(text);
+    yeast_checkpoint point = {0, 0};
+
+    // Binary search for the last checkpoint not past the character
+    if (build(offsets, text)) {
+        if (chr >= offsets->nchars)
+            return length;
+        uint32_t lo = 0, hi = nstored(offsets);
+        while (hi - lo > 1) {
+            uint32_t mid = lo + (hi - lo) / 2;
+            if (get(offsets, mid).chars <= chr)
+                lo = mid;
+            else
+                hi = mid;
+        }
+        point = get(offsets, lo);
+    }
+
+    // Scan forward from the checkpoint
+    uint32_t n = point.chars;
+    uint32_t byte = point.byte;
+    while (byte < length) {
+        uint32_t nbytes;
+        const char *chunk = yeast_text_chunk(text, byte, &nbytes);
+        for (uint32_t i = 0; i < nbytes; i++) {
+            if (((unsigned char) chunk[i] & 0xc0) == 0x80)
+                continue;
+            if (n == chr)
+                return byte + i;
+            n++;
+        }
+        byte += nbytes;
+    }
+
+    return length;
+}
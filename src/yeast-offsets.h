@@ -0,0 +1,79 @@
+#include <stdint.h>
+
+#include "yeast-text.h"
+
+#ifndef YEAST_OFFSETS_H
+#define YEAST_OFFSETS_H
+
+/**
+ * A checkpoint: the number of characters starting before a byte offset.
+ */
+typedef struct {
+    uint32_t byte;
+    uint32_t chars;
+} yeast_checkpoint;
+
+/**
+ * Index for converting between byte and character offsets in a UTF-8 text.
+ * Stores checkpoints at most a fixed number of bytes apart. The index is built
+ * in full the first time it's used, and then updated incrementally on edits.
+ * Like the line table, it's a gap buffer: checkpoints before the gap are
+ * absolute, and checkpoints after the gap are stored as the distance to the end
+ * of the text (in bytes and characters), so that edits don't need to shift them.
+ * LENGTH and NCHARS are the size of the text, and are only valid if BUILT.
+ */
+typedef struct {
+    yeast_checkpoint *points;
+    uint32_t size;
+    uint32_t gap_start;
+    uint32_t gap_end;
+    uint32_t length;
+    uint32_t nchars;
+    bool built;
+} yeast_offsets;
+
+/**
+ * Initialize an empty index.
+ * @param offsets The index to initialize.
+ */
+void yeast_offsets_init(yeast_offsets *offsets);
+
+/**
+ * Release the memory held by an index.
+ * @param offsets The index to free.
+ */
+void yeast_offsets_free(yeast_offsets *offsets);
+
+/**
+ * Update an index after an edit.
+ * Only the text between the checkpoints around the edit is scanned.
+ * @param offsets The index.
+ * @param text The text, after the edit.
+ * @param start The first byte of the edit.
+ * @param old_end The end of the replaced text, in the old text.
+ * @param new_end The end of the replacement, in the new text.
+ */
+void yeast_offsets_edit(yeast_offsets *offsets, const yeast_text *text,
+                        uint32_t start, uint32_t old_end, uint32_t new_end);
+
+/**
+ * Convert a byte offset to a character offset.
+ * If the byte offset is in the middle of a character, the offset of the
+ * following character is returned.
+ * @param offsets The index.
+ * @param text The text indexed by OFFSETS.
+ * @param byte The byte offset (zero-based).
+ * @return The character offset (zero-based).
+ */
+uint32_t yeast_offsets_char(yeast_offsets *offsets, const yeast_text *text, uint32_t byte);
+
+/**
+ * Convert a character offset to a byte offset.
+ * @param offsets The index.
+ * @param text The text indexed by OFFSETS.
+ * @param chr The character offset (zero-based).
+ * @return The byte offset (zero-based), clamped to the length of the text.
+ */
+uint32_t yeast_offsets_byte(yeast_offsets *offsets, const yeast_text *text, uint32_t chr);
+
+#endif /* YEAST_OFFSETS_H */
@@ -0,0 +1,443 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "tree_sitter/runtime.h"
+
+#include "interface.h"
+#include "yeast.h"
+#include "yeast-instance.h"
+#include "yeast-query.h"
+
+YEAST_DOC(query_p, "OBJ", "Return non-nil if OBJ is a yeast query.");
+emacs_value yeast_query_p(emacs_env *env, emacs_value obj)
+{
+    yeast_type type = yeast_get_type(env, obj);
+    return type == YEAST_QUERY ? em_t : em_nil;
+}
+
+void yeast_query_destroy(yeast_query *query)
+{
+    for (uint32_t i = 0; i < query->nsteps; i++)
+        free(query->steps[i].symbols);
+    free(query->steps);
+    free(query->patterns);
+    for (uint32_t i = 0; i < query->ncaptures; i++)
+        free(query->captures[i]);
+    free(query->captures);
+    free(query);
+}
+
+/**
+ * Signal an error about a malformed pattern.
+ */
+static void signal_pattern_error(emacs_env *env, const char *message, const char *name)
+{
+    char buf[256];
+    snprintf(buf, sizeof(buf), "%s: %s", message, name);
+    em_signal_error(env, buf);
+}
+
+/**
+ * Append an empty step to a query being compiled.
+ * @return The index of the new step, or -1 if out of memory.
+ */
+static int64_t add_step(yeast_query *query, uint32_t *capacity)
+{
+    if (query->nsteps == *capacity) {
+        uint32_t new_capacity = *capacity ? 2 * *capacity : 16;
+        yeast_query_step *steps = (yeast_query_step*)
+            realloc(query->steps, new_capacity * sizeof(yeast_query_step));
+        if (!steps)
+            return -1;
+        query->steps = steps;
+        *capacity = new_capacity;
+    }
+    query->steps[query->nsteps] = (yeast_query_step) {NULL, false, 0, -1};
+    return query->nsteps++;
+}
+
+/**
+ * Fill in the symbols matched by a step: all named (or anonymous) symbols with the given name.
+ * @return False if no symbol has that name, or out of memory.
+ */
+static bool resolve_type(emacs_env *env, yeast_query *query, yeast_query_step *step,
+                         const char *name, bool named)
+{
+    const TSLanguage *language = query->language->language;
+    uint32_t nsymbols = query->nsymbols;
+
+    step->error = named && !strcmp(name, "ERROR");
+    step->symbols = (uint64_t*) calloc((nsymbols + 63) / 64, sizeof(uint64_t));
+    if (!step->symbols) {
+        em_signal_error(env, "out of memory");
+        return false;
+    }
+
+    bool found = step->error;
+    for (uint32_t i = 0; i < nsymbols; i++) {
+        TSSymbolType type = ts_language_symbol_type(language, (TSSymbol) i);
+        if ((named ? type != TSSymbolTypeRegular : type != TSSymbolTypeAnonymous) ||
+            strcmp(name, ts_language_symbol_name(language, (TSSymbol) i)))
+            continue;
+        step->symbols[i / 64] |= (uint64_t) 1 << (i % 64);
+        found = true;
+    }
+
+    if (!found)
+        signal_pattern_error(env, "unknown node type", name);
+    return found;
+}
+
+/**
+ * Find or add a capture by name (without the leading @).
+ * @return The capture index, or -1 if out of memory.
+ */
+static int32_t find_capture(yeast_query *query, const char *name)
+{
+    for (uint32_t i = 0; i < query->ncaptures; i++)
+        if (!strcmp(query->captures[i], name))
+            return i;
+
+    char **captures = (char**) realloc(query->captures, (query->ncaptures + 1) * sizeof(char*));
+    if (!captures)
+        return -1;
+    query->captures = captures;
+    captures[query->ncaptures] = strdup(name);
+    if (!captures[query->ncaptures])
+        return -1;
+    return query->ncaptures++;
+}
+
+static bool compile_list(emacs_env *env, yeast_query *query, uint32_t *capacity,
+                         emacs_value list, bool top);
+
+/**
+ * Compile a single pattern: a symbol or a string (a leaf node),
+ * or a list (TYPE SUBPATTERN...).
+ * @return False if an error was signaled.
+ */
+static bool compile_pattern(emacs_env *env, yeast_query *query, uint32_t *capacity, emacs_value pattern)
+{
+    emacs_value head = pattern, rest = em_nil;
+    if (em_consp(env, pattern)) {
+        head = em_car(env, pattern);
+        rest = em_cdr(env, pattern);
+    }
+
+    int64_t index = add_step(query, capacity);
+    if (index < 0) {
+        em_signal_error(env, "out of memory");
+        return false;
+    }
+
+    emacs_value type = env->type_of(env, head);
+    bool named = env->eq(env, type, em_symbol);
+    if (!named && !env->eq(env, type, em_string)) {
+        em_signal_wrong_type(env, em_symbolp, head);
+        return false;
+    }
+
+    char *name = named ? em_symbol_name(env, head) : em_get_string(env, head);
+    bool success;
+    if (named && name[0] == '@') {
+        signal_pattern_error(env, "capture without a pattern", name);
+        success = false;
+    }
+    else if (named && !strcmp(name, "_"))
+        success = true;
+    else
+        success = resolve_type(env, query, &query->steps[index], name, named);
+    free(name);
+
+    if (success && YEAST_EXTRACT_BOOLEAN(rest))
+        success = compile_list(env, query, capacity, rest, false);
+
+    // The steps array may have moved
+    query->steps[index].end = query->nsteps;
+    return success;
+}
+
+/**
+ * Compile a list of patterns, each optionally followed by a capture symbol.
+ * At the top level, the start of each pattern is recorded.
+ * @return False if an error was signaled.
+ */
+static bool compile_list(emacs_env *env, yeast_query *query, uint32_t *capacity,
+                         emacs_value list, bool top)
+{
+    int64_t last = -1;
+
+    while (em_consp(env, list)) {
+        emacs_value item = em_car(env, list);
+        list = em_cdr(env, list);
+
+        if (env->eq(env, env->type_of(env, item), em_symbol)) {
+            char *name = em_symbol_name(env, item);
+            bool capture = name[0] == '@';
+            if (capture && last < 0) {
+                signal_pattern_error(env, "capture without a pattern", name);
+                free(name);
+                return false;
+            }
+            if (capture) {
+                int32_t index = find_capture(query, name + 1);
+                free(name);
+                if (index < 0) {
+                    em_signal_error(env, "out of memory");
+                    return false;
+                }
+                query->steps[last].capture = index;
+                continue;
+            }
+            free(name);
+        }
+
+        last = query->nsteps;
+        if (top) {
+            uint32_t *patterns = (uint32_t*)
+                realloc(query->patterns, (query->npatterns + 1) * sizeof(uint32_t));
+            if (!patterns) {
+                em_signal_error(env, "out of memory");
+                return false;
+            }
+            query->patterns = patterns;
+            query->patterns[query->npatterns++] = last;
+        }
+        if (!compile_pattern(env, query, capacity, item))
+            return false;
+    }
+
+    return true;
+}
+
+YEAST_DOC(query_compile, "LANGUAGE PATTERNS",
+          "Compile PATTERNS into a query for LANGUAGE.\n\n"
+          "PATTERNS is a list of patterns. A pattern is a symbol, matching a\n"
+          "named node of that type, a string, matching an anonymous node of\n"
+          "that type, or a list (TYPE SUBPATTERN...), matching a node whose\n"
+          "children match the subpatterns in order. The type `_' matches any\n"
+          "named node. A symbol starting with @ following a pattern captures\n"
+          "the node matched by it.");
+emacs_value yeast_query_compile(emacs_env *env, emacs_value _language, emacs_value _patterns)
+{
+    YEAST_ASSERT_SYMBOL(_language);
+    yeast_language *language = yeast_language_find(env, _language);
+    if (!language)
+        return em_nil;
+
+    yeast_query *query = (yeast_query*) calloc(1, sizeof(yeast_query));
+    if (!query) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    query->header = (yeast_header) {YEAST_QUERY, 0};
+    query->language = language;
+    query->nsymbols = ts_language_symbol_count(language->language);
+
+    uint32_t capacity = 0;
+    if (!compile_list(env, query, &capacity, _patterns, true)) {
+        yeast_query_destroy(query);
+        return em_nil;
+    }
+
+    return env->make_user_ptr(env, yeast_finalize, query);
+}
+
+YEAST_DOC(query_captures, "QUERY",
+          "Get a vector of the capture names of QUERY, indexed by capture id.");
+emacs_value yeast_query_captures(emacs_env *env, emacs_value _query)
+{
+    YEAST_ASSERT_QUERY(_query);
+    yeast_query *query = YEAST_EXTRACT_QUERY(_query);
+
+    emacs_value *names = (emacs_value*) malloc((query->ncaptures + 1) * sizeof(emacs_value));
+    if (!names) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    for (uint32_t i = 0; i < query->ncaptures; i++)
+        names[i] = env->intern(env, query->captures[i]);
+    emacs_value retval = em_vector(env, query->ncaptures, names);
+    free(names);
+    return retval;
+}
+
+static bool buffer_push(yeast_query_results *buffer, uint32_t a, uint32_t b, uint32_t c, uint32_t d)
+{
+    if (buffer->length + 4 > buffer->capacity) {
+        size_t capacity = buffer->capacity ? 2 * buffer->capacity : 256;
+        uint32_t *data = (uint32_t*) realloc(buffer->data, capacity * sizeof(uint32_t));
+        if (!data)
+            return false;
+        buffer->data = data;
+        buffer->capacity = capacity;
+    }
+    uint32_t *p = buffer->data + buffer->length;
+    p[0] = a; p[1] = b; p[2] = c; p[3] = d;
+    buffer->length += 4;
+    return true;
+}
+
+/**
+ * Check whether a node matches a step, disregarding its subpatterns.
+ */
+static bool step_matches(const yeast_query *query, const yeast_query_step *step, TSNode node)
+{
+    if (!step->symbols)
+        return ts_node_is_named(node);
+    TSSymbol symbol = ts_node_symbol(node);
+    if (symbol == ts_builtin_sym_error)
+        return step->error;
+    if (symbol >= query->nsymbols)
+        return false;
+    return (step->symbols[symbol / 64] >> (symbol % 64)) & 1;
+}
+
+static bool match_children(const yeast_query *query, uint32_t step, uint32_t end,
+                           TSNode node, yeast_query_results *captures);
+
+/**
+ * Match a node against a step and its subpatterns, recording captures.
+ * On failure, the captures are left as they were.
+ * @return False if the node doesn't match (or out of memory).
+ */
+static bool match(const yeast_query *query, uint32_t index, TSNode node, yeast_query_results *captures)
+{
+    const yeast_query_step *step = &query->steps[index];
+    if (!step_matches(query, step, node))
+        return false;
+
+    size_t saved = captures->length;
+    if (step->capture >= 0 &&
+        !buffer_push(captures, step->capture, ts_node_start_byte(node), ts_node_end_byte(node), 0))
+        return false;
+    if (match_children(query, index + 1, step->end, node, captures))
+        return true;
+    captures->length = saved;
+    return false;
+}
+
+/**
+ * Match the subpatterns from STEP to END against the children of a node, in order.
+ * Whether a child matches a subpattern doesn't depend on the children matched
+ * by the others, so taking the first child that matches each subpattern in turn
+ * finds a match if there is one, without backtracking. Children are visited
+ * with a cursor, as getting a child by index is linear in this runtime.
+ * On failure, the captures of the subpatterns that did match are left for the
+ * caller to drop.
+ */
+static bool match_children(const yeast_query *query, uint32_t step, uint32_t end,
+                           TSNode node, yeast_query_results *captures)
+{
+    if (step == end)
+        return true;
+
+    TSTreeCursor cursor = ts_tree_cursor_new(node);
+    bool more = ts_tree_cursor_goto_first_child(&cursor);
+    while (more && step < end) {
+        if (match(query, step, ts_tree_cursor_current_node(&cursor), captures))
+            step = query->steps[step].end;
+        more = ts_tree_cursor_goto_next_sibling(&cursor);
+    }
+    ts_tree_cursor_delete(&cursor);
+    return step == end;
+}
+
+bool yeast_query_exec(const yeast_query *query, TSNode node, uint32_t beg, uint32_t end,
+                      yeast_query_results *results)
+{
+    yeast_query_results captures = {NULL, 0, 0};
+    bool success = true;
+
+    TSTreeCursor cursor = ts_tree_cursor_new(node);
+    bool descend = true;
+    while (success) {
+        TSNode current = ts_tree_cursor_current_node(&cursor);
+        bool overlaps = ts_node_start_byte(current) < end && ts_node_end_byte(current) > beg;
+
+        if (descend && overlaps) {
+            for (uint32_t p = 0; p < query->npatterns && success; p++) {
+                captures.length = 0;
+                if (!match(query, query->patterns[p], current, &captures))
+                    continue;
+                for (size_t i = 0; i < captures.length && success; i += 4)
+                    success = buffer_push(results, p, captures.data[i],
+                                          captures.data[i + 1], captures.data[i + 2]);
+            }
+            if (ts_tree_cursor_goto_first_child(&cursor))
+                continue;
+        }
+
+        if (ts_tree_cursor_goto_next_sibling(&cursor))
+            descend = true;
+        else if (ts_tree_cursor_goto_parent(&cursor))
+            descend = false;
+        else
+            break;
+    }
+    ts_tree_cursor_delete(&cursor);
+    free(captures.data);
+
+    return success;
+}
+
+YEAST_DOC(query_run, "QUERY NODE &optional BEG END",
+          "Run QUERY over NODE and its descendants.\n\n"
+          "If BEG and END are given, only nodes overlapping that region are\n"
+          "considered. Return a vector [PATTERN CAPTURE BEG END ...] with four\n"
+          "elements per captured node. Matches are ordered by the start of the\n"
+          "node matching the whole pattern (parents before their children), then\n"
+          "by pattern. Within a match, a capture comes before the captures of its\n"
+          "subpatterns. PATTERN and CAPTURE are indices into the patterns and\n"
+          "`yeast--query-captures'.");
+emacs_value yeast_query_run(emacs_env *env, emacs_value _query, emacs_value _node,
+                            emacs_value _beg, emacs_value _end)
+{
+    YEAST_ASSERT_QUERY(_query);
+    YEAST_ASSERT_NODE(_node);
+    yeast_query *query = YEAST_EXTRACT_QUERY(_query);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    yeast_instance *instance = node->tree->instance;
+
+    if (instance->language != query->language) {
+        em_signal_error(env, "query and node have different languages");
+        return em_nil;
+    }
+
+    uint32_t beg = 0, end = UINT32_MAX;
+    if (YEAST_EXTRACT_BOOLEAN(_beg)) {
+        YEAST_ASSERT_INTEGER(_beg);
+        intmax_t pos = YEAST_EXTRACT_INTEGER(_beg);
+        beg = yeast_instance_byte(instance, pos);
+    }
+    if (YEAST_EXTRACT_BOOLEAN(_end)) {
+        YEAST_ASSERT_INTEGER(_end);
+        intmax_t pos = YEAST_EXTRACT_INTEGER(_end);
+        end = yeast_instance_byte(instance, pos);
+    }
+
+    yeast_query_results results = {NULL, 0, 0};
+    if (!yeast_query_exec(query, node->node, beg, end, &results)) {
+        free(results.data);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+
+    emacs_value *values = (emacs_value*) malloc((results.length + 1) * sizeof(emacs_value));
+    if (!values) {
+        free(results.data);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    for (size_t i = 0; i < results.length; i += 4) {
+        values[i] = env->make_integer(env, results.data[i]);
+        values[i + 1] = env->make_integer(env, results.data[i + 1]);
+        values[i + 2] = env->make_integer(env, yeast_instance_position(instance, results.data[i + 2]));
+        values[i + 3] = env->make_integer(env, yeast_instance_position(instance, results.data[i + 3]));
+    }
+    emacs_value retval = em_vector(env, results.length, values);
+    free(values);
+    free(results.data);
+    return retval;
+}
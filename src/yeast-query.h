@@ -0,0 +1,40 @@
+#include "yeast.h"
+
+#ifndef YEAST_QUERY_H
+#define YEAST_QUERY_H
+
+YEAST_DEFUN(query_p, emacs_value obj);
+YEAST_DEFUN(query_compile, emacs_value _language, emacs_value _patterns);
+YEAST_DEFUN(query_captures, emacs_value _query);
+YEAST_DEFUN(query_run, emacs_value _query, emacs_value _node, emacs_value _beg, emacs_value _end);
+
+/**
+ * Results of running a query: four integers per captured node,
+ * the pattern index, the capture index and the byte range.
+ */
+typedef struct {
+    uint32_t *data;
+    size_t length;
+    size_t capacity;
+} yeast_query_results;
+
+/**
+ * Run a query over a node and its descendants.
+ * Results are appended in the order that matched nodes are visited (preorder).
+ * @param query The query.
+ * @param node The node.
+ * @param beg Skip nodes ending at or before this byte.
+ * @param end Skip nodes starting at or after this byte.
+ * @param results The results (initially zeroed).
+ * @return False if out of memory.
+ */
+bool yeast_query_exec(const yeast_query *query, TSNode node, uint32_t beg, uint32_t end,
+                      yeast_query_results *results);
+
+/**
+ * Free a query and everything it owns.
+ * @param query The query.
+ */
+void yeast_query_destroy(yeast_query *query);
+
+#endif /* YEAST_QUERY_H */
@@ -0,0 +1,164 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "yeast-text.h"
+
+// Minimal size of the gap after the buffer has been reallocated
+#define MIN_GAP 4096
+
+void yeast_text_init(yeast_text *text)
+{
+    *text = (yeast_text) {NULL, 0, 0, 0, false};
+}
+
+void yeast_text_free(yeast_text *text)
+{
+    if (text->mapped)
+        munmap(text->data, text->size);
+    else
+        free(text->data);
+    yeast_text_init(text);
+}
+
+bool yeast_text_map(yeast_text *text, const char *path)
+{
+    yeast_text_init(text);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+
+    struct stat st;
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_size > UINT32_MAX) {
+        close(fd);
+        return false;
+    }
+
+    // An empty file can't be mapped, but it's a perfectly good empty text
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED)
+        return false;
+
+    uint32_t size = st.st_size;
+    madvise(data, size, MADV_SEQUENTIAL);
+    *text = (yeast_text) {(char*) data, size, size, size, true};
+    return true;
+}
+
+bool yeast_text_copy(yeast_text *dest, const yeast_text *src)
+{
+    yeast_text_init(dest);
+    uint32_t length = yeast_text_length(src);
+    char *data = yeast_text_reserve(dest, 0, 0, length);
+    if (!data)
+        return false;
+
+    uint32_t before = src->gap_start;
+    memcpy(data, src->data, before);
+    memcpy(data + before, src->data + src->gap_end, length - before);
+    yeast_text_commit(dest, length);
+    return true;
+}
+
+uint32_t yeast_text_length(const yeast_text *text)
+{
+    return text->size - (text->gap_end - text->gap_start);
+}
+
+/**
+ * Move the gap so that it starts at a given offset.
+ */
+static void move_gap(yeast_text *text, uint32_t offset)
+{
+    if (offset < text->gap_start) {
+        uint32_t n = text->gap_start - offset;
+        memmove(text->data + text->gap_end - n, text->data + offset, n);
+        text->gap_start -= n;
+        text->gap_end -= n;
+    }
+    else if (offset > text->gap_start) {
+        uint32_t n = offset - text->gap_start;
+        memmove(text->data + text->gap_start, text->data + text->gap_end, n);
+        text->gap_start += n;
+        text->gap_end += n;
+    }
+}
+
+/**
+ * Make sure the gap can hold at least a given number of bytes.
+ */
+static bool ensure_gap(yeast_text *text, uint32_t nbytes)
+{
+    if (text->gap_end - text->gap_start >= nbytes)
+        return true;
+
+    uint32_t tail = text->size - text->gap_end;
+    uint32_t new_size = yeast_text_length(text) + nbytes + MIN_GAP;
+    if (new_size < 2 * text->size)
+        new_size = 2 * text->size;
+
+    char *data = (char*) realloc(text->data, new_size);
+    if (!data)
+        return false;
+
+    memmove(data + new_size - tail, data + text->gap_end, tail);
+    text->data = data;
+    text->gap_end = new_size - tail;
+    text->size = new_size;
+    return true;
+}
+
+bool yeast_text_unmap(yeast_text *text)
+{
+    if (!text->mapped)
+        return true;
+
+    yeast_text copy;
+    if (!yeast_text_copy(&copy, text))
+        return false;
+    yeast_text_free(text);
+    *text = copy;
+    return true;
+}
+
+char *yeast_text_reserve(yeast_text *text, uint32_t start, uint32_t end, uint32_t nbytes)
+{
+    if (!yeast_text_unmap(text))
+        return NULL;
+    move_gap(text, start);
+    text->gap_end += end - start;
+    if (!ensure_gap(text, nbytes + 1))
+        return NULL;
+    return text->data + text->gap_start;
+}
+
+void yeast_text_commit(yeast_text *text, uint32_t nbytes)
+{
+    text->gap_start += nbytes;
+}
+
+const char *yeast_text_chunk(const yeast_text *text, uint32_t offset, uint32_t *nbytes)
+{
+    if (offset < text->gap_start) {
+        *nbytes = text->gap_start - offset;
+        return text->data + offset;
+    }
+
+    uint32_t length = yeast_text_length(text);
+    if (offset >= length) {
+        *nbytes = 0;
+        return "";
+    }
+
+    *nbytes = length - offset;
+    return text->data + text->gap_end + (offset - text->gap_start);
+}
@@ -0,0 +1,96 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifndef YEAST_TEXT_H
+#define YEAST_TEXT_H
+
+/**
+ * Native mirror of the text of an Emacs buffer.
+ * The text is stored in a gap buffer, so that consecutive edits close
+ * to each other (e.g. typing) only move a few bytes around.
+ * A text may instead be a read-only mapping of a file, with the gap at the end.
+ * It is then copied to memory on the first edit.
+ */
+typedef struct {
+    char *data;
+    uint32_t size;
+    uint32_t gap_start;
+    uint32_t gap_end;
+    bool mapped;
+} yeast_text;
+
+/**
+ * Initialize an empty text.
+ * @param text The text to initialize.
+ */
+void yeast_text_init(yeast_text *text);
+
+/**
+ * Release the memory held by a text.
+ * @param text The text to free.
+ */
+void yeast_text_free(yeast_text *text);
+
+/**
+ * Initialize a text as a copy of another.
+ * @param dest The text to initialize.
+ * @param src The text to copy.
+ * @return False if out of memory, in which case DEST is empty.
+ */
+bool yeast_text_copy(yeast_text *dest, const yeast_text *src);
+
+/**
+ * Initialize a text as a mapping of the contents of a file.
+ * The file must not be truncated while the text is in use, so the mapping
+ * should be short-lived: see yeast_text_unmap.
+ * @param text The text to initialize.
+ * @param path The path of the file.
+ * @return False if the file can't be mapped, in which case TEXT is empty.
+ */
+bool yeast_text_map(yeast_text *text, const char *path);
+
+/**
+ * Replace a mapped text by a copy in memory.
+ * Does nothing if the text is not mapped.
+ * @param text The text.
+ * @return False if out of memory, in which case TEXT is left mapped.
+ */
+bool yeast_text_unmap(yeast_text *text);
+
+/**
+ * Get the length of a text in bytes.
+ * @param text The text.
+ * @return The number of bytes.
+ */
+uint32_t yeast_text_length(const yeast_text *text);
+
+/**
+ * Prepare a text for a replacement.
+ * Deletes the bytes between START and END and returns a pointer where the
+ * caller may write NBYTES new bytes, plus one scratch byte for a terminating
+ * null. The new bytes are not part of the text until yeast_text_commit is called.
+ * @param text The text to modify.
+ * @param start The first byte to delete.
+ * @param end The first byte after START not to delete.
+ * @param nbytes The number of bytes to be inserted.
+ * @return Pointer to writable memory, or NULL if out of memory.
+ */
+char *yeast_text_reserve(yeast_text *text, uint32_t start, uint32_t end, uint32_t nbytes);
+
+/**
+ * Finalize a replacement started with yeast_text_reserve.
+ * @param text The text to modify.
+ * @param nbytes The number of bytes that were written.
+ */
+void yeast_text_commit(yeast_text *text, uint32_t nbytes);
+
+/**
+ * Get a contiguous chunk of text.
+ * @param text The text to read from.
+ * @param offset The byte offset to start reading from.
+ * @param nbytes Output parameter for the length of the chunk.
+ * @return Pointer to the chunk (borrowed).
+ */
+const char *yeast_text_chunk(const yeast_text *text, uint32_t offset, uint32_t *nbytes);
+
+#endif /* YEAST_TEXT_H */
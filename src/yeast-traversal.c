@@ -1,24 +1,42 @@
 #include <assert.h>
+#include <stdlib.h>
 
 #include "tree_sitter/runtime.h"
 
 #include "interface.h"
 #include "yeast.h"
+#include "yeast-instance.h"
 #include "yeast-traversal.h"
 
+emacs_value yeast_tree_node(emacs_env *env, yeast_tree *tree, TSNode new)
+{
+    if (ts_node_is_null(new))
+        return em_nil;
+    assert(new.tree == tree->tree);
+    yeast_node *retval = yeast_node_alloc(tree);
+    if (!retval) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    retval->node = new;
+    return env->make_user_ptr(env, yeast_finalize, retval);
+}
+
 /**
  * Convenience function for returning a new node belonging to
  * the same tree as an existing node.
  */
 static emacs_value new_node_from_node(emacs_env *env, yeast_node *node, TSNode new)
 {
-    if (ts_node_is_null(new))
-        return em_nil;
-    assert(new.tree == node->tree->tree);
-    node->tree->header.refcount++;
-    yeast_node *retval = (yeast_node*) malloc(sizeof(yeast_node));
-    *retval = (yeast_node) {{YEAST_NODE, 0}, node->tree, new};
-    return env->make_user_ptr(env, yeast_finalize, retval);
+    return yeast_tree_node(env, node->tree, new);
+}
+
+/**
+ * Get the buffer positions of a node as a cons cell.
+ */
+static emacs_value node_range(emacs_env *env, yeast_instance *instance, TSNode node)
+{
+    return yeast_instance_range(env, instance, ts_node_start_byte(node), ts_node_end_byte(node));
 }
 
 YEAST_DOC(tree_p, "OBJ", "Return non-nil if OBJ is a yeast tree.");
@@ -49,22 +67,110 @@ emacs_value yeast_node_eq(emacs_env *env, emacs_value _obj1, emacs_value _obj2)
     return ts_node_eq(node1->node, node2->node) ? em_t : em_nil;
 }
 
-YEAST_DOC(instance_tree, "INSTANCE", "Get the current tree in INSTANCE.");
+emacs_value yeast_instance_snapshot(emacs_env *env, yeast_instance *instance)
+{
+    yeast_tree *retval = (yeast_tree*) malloc(sizeof(yeast_tree));
+    if (!retval) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    yeast_retain(instance);
+    TSTree *tree = ts_tree_copy(instance->tree);
+    *retval = (yeast_tree) {{YEAST_TREE, 1}, instance, tree, instance->generation, {NULL, NULL, 0}};
+    instance->snapshot = retval;
+    instance->handles.trees++;
+    instance->handles.live_trees++;
+    return env->make_user_ptr(env, yeast_finalize, retval);
+}
+
+YEAST_DOC(instance_tree, "INSTANCE",
+          "Get the current tree in INSTANCE.\n\n"
+          "Pending edits are parsed first. In asynchronous mode, a background\n"
+          "parse is started instead, and the previous tree is returned. With a time\n"
+          "budget, pending edits are parsed until it runs out, and the previous\n"
+          "tree is returned if the parse is not finished. Return nil if there is\n"
+          "no tree yet, because the first parse is not finished.\n\n"
+          "Until the tree is replaced, repeated calls return the same snapshot.");
 emacs_value yeast_instance_tree(emacs_env *env, emacs_value _instance)
 {
     YEAST_ASSERT_INSTANCE(_instance);
     yeast_instance *instance = YEAST_EXTRACT_INSTANCE(_instance);
+    yeast_instance_update(instance);
+    if (!instance->tree)
+        return em_nil;
+
+    yeast_tree *snapshot = instance->snapshot;
+    if (snapshot && snapshot->generation == instance->generation) {
+        yeast_retain(snapshot);
+        return env->make_user_ptr(env, yeast_finalize, snapshot);
+    }
+    return yeast_instance_snapshot(env, instance);
+}
 
-    if (!instance->tree) {
-        em_signal_error(env, "instance has no tree");
+YEAST_DOC(parse_file, "LANGUAGE FILE",
+          "Parse FILE as LANGUAGE, and return the tree.\n\n"
+          "FILE is read from disk by mapping it into memory, without visiting it\n"
+          "in a buffer. Positions in the tree are counted from 1 as if the file\n"
+          "was in a buffer, and byte offsets from 0. The text is copied to memory\n"
+          "once parsed, so that the tree does not depend on FILE afterwards.");
+emacs_value yeast_parse_file(emacs_env *env, emacs_value _language, emacs_value _file)
+{
+    YEAST_ASSERT_SYMBOL(_language);
+    YEAST_ASSERT_STRING(_file);
+    yeast_language *language = yeast_language_find(env, _language);
+    if (!language)
+        return em_nil;
+
+    char *file = YEAST_EXTRACT_STRING(_file);
+    yeast_text text;
+    bool mapped = yeast_text_map(&text, file);
+    free(file);
+    if (!mapped) {
+        em_signal_error(env, "could not read file");
         return em_nil;
     }
 
-    instance->header.refcount++;
-    TSTree *tree = ts_tree_copy(instance->tree);
-    yeast_tree *retval = (yeast_tree*) malloc(sizeof(yeast_tree));
-    *retval = (yeast_tree) {{YEAST_TREE, 1}, instance, tree};
-    return env->make_user_ptr(env, yeast_finalize, retval);
+    yeast_instance *instance = yeast_instance_from_text(language, &text, NULL);
+    if (!instance) {
+        em_signal_error(env, "could not parse file");
+        return em_nil;
+    }
+
+    // Don't keep the mapping in Lisp, where a truncated file would cause SIGBUS
+    if (!yeast_text_unmap(&instance->text)) {
+        yeast_finalize(instance);
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+
+    // The tree holds the only reference to the instance
+    emacs_value retval = yeast_instance_snapshot(env, instance);
+    yeast_finalize(instance);
+    return retval;
+}
+
+YEAST_DOC(current_p, "OBJ",
+          "Return non-nil if OBJ belongs to the current tree of its instance.\n\n"
+          "OBJ may be a tree, a node or a cursor. The current tree does not\n"
+          "reflect edits that have not been parsed yet.");
+emacs_value yeast_current_p(emacs_env *env, emacs_value obj)
+{
+    yeast_tree *tree;
+    switch (yeast_get_type(env, obj)) {
+    case YEAST_TREE:
+        tree = YEAST_EXTRACT_TREE(obj);
+        break;
+    case YEAST_NODE:
+        tree = YEAST_EXTRACT_NODE(obj)->tree;
+        break;
+    case YEAST_CURSOR:
+        tree = YEAST_EXTRACT_CURSOR(obj)->tree;
+        break;
+    default:
+        em_signal_wrong_type(env, em_yeast_tree_p, obj);
+        return em_nil;
+    }
+    return tree->generation == tree->instance->generation ? em_t : em_nil;
 }
 
 YEAST_DOC(tree_root, "TREE", "Get the root node of TREE.");
@@ -74,13 +180,7 @@ emacs_value yeast_tree_root(emacs_env *env, emacs_value _tree)
     yeast_tree *tree = YEAST_EXTRACT_TREE(_tree);
 
     TSNode node = ts_tree_root_node(tree->tree);
-    if (ts_node_is_null(node))
-        return em_nil;
-
-    tree->header.refcount++;
-    yeast_node *retval = (yeast_node*) malloc(sizeof(yeast_node));
-    *retval = (yeast_node) {{YEAST_NODE, 0}, tree, node};
-    return env->make_user_ptr(env, yeast_finalize, retval);
+    return yeast_tree_node(env, tree, node);
 }
 
 YEAST_DOC(node_type, "NODE", "Get the type of NODE.");
@@ -88,8 +188,18 @@ emacs_value yeast_node_type(emacs_env *env, emacs_value _node)
 {
     YEAST_ASSERT_NODE(_node);
     yeast_node *node = YEAST_EXTRACT_NODE(_node);
-    const char *type = ts_node_type(node->node);
-    return env->intern(env, type);
+    yeast_language *language = node->tree->instance->language;
+    return yeast_language_type(env, language, ts_node_symbol(node->node));
+}
+
+YEAST_DOC(node_symbol, "NODE",
+          "Get the grammar symbol id of NODE.\n\n"
+          "This is an index into the vector returned by `yeast--language-types'.");
+emacs_value yeast_node_symbol(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    return env->make_integer(env, ts_node_symbol(node->node));
 }
 
 YEAST_DOC(node_child_count, "NODE &optional ANON",
@@ -165,6 +275,286 @@ emacs_value yeast_node_child_for_byte(emacs_env *env, emacs_value _node, emacs_v
     return new_node_from_node(env, node, child);
 }
 
+YEAST_DOC(node_start, "NODE", "Get the starting position of NODE.");
+emacs_value yeast_node_start(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    yeast_instance *instance = node->tree->instance;
+    return env->make_integer(env, yeast_instance_position(instance, ts_node_start_byte(node->node)));
+}
+
+YEAST_DOC(node_end, "NODE", "Get the ending position of NODE.");
+emacs_value yeast_node_end(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    yeast_instance *instance = node->tree->instance;
+    return env->make_integer(env, yeast_instance_position(instance, ts_node_end_byte(node->node)));
+}
+
+YEAST_DOC(node_range, "NODE", "Get the range of buffer positions of NODE as a cons cell.");
+emacs_value yeast_node_range(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    return node_range(env, node->tree->instance, node->node);
+}
+
+/**
+ * Convert a node boundary to a cons cell (LINE . COLUMN).
+ * Lines are one-based, and columns are counted in characters.
+ */
+static emacs_value point_to_cons(emacs_env *env, yeast_instance *instance, uint32_t byte, TSPoint point)
+{
+    intmax_t column = yeast_instance_position(instance, byte) -
+        yeast_instance_position(instance, byte - point.column);
+    return em_cons(env, env->make_integer(env, 1 + point.row), env->make_integer(env, column));
+}
+
+YEAST_DOC(node_point_range, "NODE",
+          "Get the line and column range of NODE.\n\n"
+          "The return value has the form ((START-LINE . START-COLUMN) . (END-LINE . END-COLUMN)).\n"
+          "Lines are one-based, and columns are counted in characters from zero.");
+emacs_value yeast_node_point_range(emacs_env *env, emacs_value _node)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    yeast_instance *instance = node->tree->instance;
+    return em_cons(
+        env,
+        point_to_cons(env, instance, ts_node_start_byte(node->node), ts_node_start_point(node->node)),
+        point_to_cons(env, instance, ts_node_end_byte(node->node), ts_node_end_point(node->node))
+    );
+}
+
+YEAST_DOC(node_child_for_pos, "NODE POS &optional ANON",
+          "Get the first child of NODE for buffer position POS.\n\n"
+          "If ANON is nil, count only the named children.");
+emacs_value yeast_node_child_for_pos(emacs_env *env, emacs_value _node, emacs_value _pos, emacs_value _anon)
+{
+    YEAST_ASSERT_NODE(_node);
+    YEAST_ASSERT_INTEGER(_pos);
+
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    intmax_t pos = YEAST_EXTRACT_INTEGER(_pos);
+    uint32_t byte = yeast_instance_byte(node->tree->instance, pos);
+    bool anon = YEAST_EXTRACT_BOOLEAN(_anon);
+
+    TSNode child = anon ? ts_node_first_child_for_byte(node->node, byte) :
+                   ts_node_first_named_child_for_byte(node->node, byte);
+    return new_node_from_node(env, node, child);
+}
+
+YEAST_DOC(node_at_range, "TREE BEG END",
+          "Get the smallest named node in TREE enclosing the region from BEG to END.\n\n"
+          "BEG and END are buffer positions in any order. If they are equal, the\n"
+          "character after BEG is used. If several nodes span the same range, the\n"
+          "outermost one is returned.\n\n"
+          "The return value has the form (NODE . RANGES), where RANGES is a list of\n"
+          "the distinct ranges of NODE and its ancestors, innermost first, as cons\n"
+          "cells (BEG . END).");
+emacs_value yeast_node_at_range(emacs_env *env, emacs_value _tree, emacs_value _beg, emacs_value _end)
+{
+    YEAST_ASSERT_TREE(_tree);
+    YEAST_ASSERT_INTEGER(_beg);
+    YEAST_ASSERT_INTEGER(_end);
+
+    yeast_tree *tree = YEAST_EXTRACT_TREE(_tree);
+    yeast_instance *instance = tree->instance;
+    intmax_t beg = YEAST_EXTRACT_INTEGER(_beg);
+    intmax_t end = YEAST_EXTRACT_INTEGER(_end);
+
+    intmax_t min_pos = beg < end ? beg : end;
+    intmax_t max_pos = (beg < end ? end : beg) - 1;
+    if (max_pos < min_pos)
+        max_pos = min_pos;
+
+    // The node must contain the first byte of the last character
+    uint32_t min_byte = yeast_instance_byte(instance, min_pos);
+    uint32_t max_byte = yeast_instance_byte(instance, max_pos) + 1;
+
+    TSNode root = ts_tree_root_node(tree->tree);
+    TSNode node = ts_node_named_descendant_for_byte_range(root, min_byte, max_byte);
+    if (ts_node_is_null(node))
+        return em_nil;
+
+    // Ascend to the oldest node that is not wider
+    uint32_t start = ts_node_start_byte(node), stop = ts_node_end_byte(node);
+    TSNode parent = ts_node_parent(node);
+    while (!ts_node_is_null(parent) &&
+           ts_node_start_byte(parent) == start && ts_node_end_byte(parent) == stop) {
+        node = parent;
+        parent = ts_node_parent(node);
+    }
+
+    // Collect the nodes with distinct ranges, innermost first
+    uint32_t depth = 1;
+    for (TSNode n = parent; !ts_node_is_null(n); n = ts_node_parent(n))
+        depth++;
+    TSNode *ancestors = (TSNode*) malloc(depth * sizeof(TSNode));
+    if (!ancestors) {
+        em_signal_error(env, "out of memory");
+        return em_nil;
+    }
+    uint32_t nranges = 0;
+    ancestors[nranges++] = node;
+    for (TSNode n = parent; !ts_node_is_null(n); n = ts_node_parent(n)) {
+        TSNode last = ancestors[nranges - 1];
+        if (ts_node_start_byte(n) != ts_node_start_byte(last) ||
+            ts_node_end_byte(n) != ts_node_end_byte(last))
+            ancestors[nranges++] = n;
+    }
+
+    emacs_value ranges = em_nil;
+    while (nranges > 0)
+        ranges = em_cons(env, node_range(env, instance, ancestors[--nranges]), ranges);
+    free(ancestors);
+
+    return em_cons(env, yeast_tree_node(env, tree, node), ranges);
+}
+
+/**
+ * Stack of Emacs values used to build nested lists without recursion.
+ * Each open frame starts at an index in VALUES recorded in BASES.
+ */
+typedef struct {
+    emacs_value *values;
+    size_t nvalues, values_capacity;
+    size_t *bases;
+    size_t nbases, bases_capacity;
+} sexp_stack;
+
+static bool sexp_push(sexp_stack *stack, emacs_value value)
+{
+    if (stack->nvalues == stack->values_capacity) {
+        size_t capacity = stack->values_capacity ? 2 * stack->values_capacity : 256;
+        emacs_value *values = (emacs_value*) realloc(stack->values, capacity * sizeof(emacs_value));
+        if (!values)
+            return false;
+        stack->values = values;
+        stack->values_capacity = capacity;
+    }
+    stack->values[stack->nvalues++] = value;
+    return true;
+}
+
+/**
+ * Open a new frame for a node, and push its type and optionally its range.
+ */
+static bool sexp_open(
+    emacs_env *env, sexp_stack *stack, yeast_instance *instance,
+    TSNode node, emacs_value ranges)
+{
+    if (stack->nbases == stack->bases_capacity) {
+        size_t capacity = stack->bases_capacity ? 2 * stack->bases_capacity : 64;
+        size_t *bases = (size_t*) realloc(stack->bases, capacity * sizeof(size_t));
+        if (!bases)
+            return false;
+        stack->bases = bases;
+        stack->bases_capacity = capacity;
+    }
+    stack->bases[stack->nbases++] = stack->nvalues;
+
+    emacs_value type = yeast_language_type(env, instance->language, ts_node_symbol(node));
+    if (!sexp_push(stack, type))
+        return false;
+    if (!YEAST_EXTRACT_BOOLEAN(ranges))
+        return true;
+
+    uint32_t start = ts_node_start_byte(node), end = ts_node_end_byte(node);
+    emacs_value range;
+    if (env->eq(env, ranges, em_byte))
+        range = em_cons(env, env->make_integer(env, 1 + start), env->make_integer(env, end));
+    else
+        range = yeast_instance_range(env, instance, start, end);
+    return sexp_push(stack, range);
+}
+
+/**
+ * Close the innermost frame, replacing its values with a list.
+ */
+static bool sexp_close(emacs_env *env, sexp_stack *stack)
+{
+    size_t base = stack->bases[--stack->nbases];
+    emacs_value list = em_list(env, stack->nvalues - base, stack->values + base);
+    stack->nvalues = base;
+    return sexp_push(stack, list);
+}
+
+/**
+ * Move a cursor forward to the first node (including the current one) that should be exported.
+ */
+static bool sexp_find(TSTreeCursor *cursor, bool anon)
+{
+    while (!anon && !ts_node_is_named(ts_tree_cursor_current_node(cursor)))
+        if (!ts_tree_cursor_goto_next_sibling(cursor))
+            return false;
+    return true;
+}
+
+YEAST_DOC(node_sexp, "NODE &optional ANON RANGES DEPTH",
+          "Convert the subtree at NODE to an s-expression in one pass.\n\n"
+          "Each node becomes a list (TYPE CHILD...). If ANON is nil, only named\n"
+          "nodes are included. If RANGES is `byte', each node has its byte range\n"
+          "after the type, as in `yeast--node-byte-range'. If RANGES is any other\n"
+          "non-nil value, its range of buffer positions is used instead.\n"
+          "If DEPTH is non-nil, nodes more than DEPTH levels below NODE are omitted.");
+emacs_value yeast_node_sexp(
+    emacs_env *env, emacs_value _node,
+    emacs_value _anon, emacs_value _ranges, emacs_value _depth)
+{
+    YEAST_ASSERT_NODE(_node);
+    yeast_node *node = YEAST_EXTRACT_NODE(_node);
+    yeast_instance *instance = node->tree->instance;
+    bool anon = YEAST_EXTRACT_BOOLEAN(_anon);
+
+    intmax_t max_depth = -1;
+    if (YEAST_EXTRACT_BOOLEAN(_depth)) {
+        YEAST_ASSERT_INTEGER(_depth);
+        max_depth = YEAST_EXTRACT_INTEGER(_depth);
+    }
+
+    sexp_stack stack = {NULL, 0, 0, NULL, 0, 0};
+    TSTreeCursor cursor = ts_tree_cursor_new(node->node);
+    intmax_t depth = 0;
+    bool ok = sexp_open(env, &stack, instance, node->node, _ranges);
+
+    while (ok) {
+        // Descend to the first exported child, if any
+        if ((max_depth < 0 || depth < max_depth) && ts_tree_cursor_goto_first_child(&cursor)) {
+            if (sexp_find(&cursor, anon)) {
+                depth++;
+                ok = sexp_open(env, &stack, instance, ts_tree_cursor_current_node(&cursor), _ranges);
+                continue;
+            }
+            ts_tree_cursor_goto_parent(&cursor);
+        }
+
+        // The current node is complete: close it, and those of its
+        // ancestors that have no more exported children
+        while ((ok = sexp_close(env, &stack)) && depth > 0) {
+            if (ts_tree_cursor_goto_next_sibling(&cursor) && sexp_find(&cursor, anon)) {
+                ok = sexp_open(env, &stack, instance, ts_tree_cursor_current_node(&cursor), _ranges);
+                break;
+            }
+            ts_tree_cursor_goto_parent(&cursor);
+            depth--;
+        }
+        if (depth == 0)
+            break;
+    }
+
+    emacs_value retval = ok ? stack.values[0] : em_nil;
+    ts_tree_cursor_delete(&cursor);
+    free(stack.values);
+    free(stack.bases);
+
+    if (!ok)
+        em_signal_error(env, "out of memory");
+    return retval;
+}
+
 YEAST_DOC(next_sibling, "NODE &optional ANON",
           "Get the next sibling of NODE.\n\n"
           "If ANON is nil, access only named siblings.");
@@ -8,18 +8,46 @@ YEAST_DEFUN(node_p, emacs_value obj);
 YEAST_DEFUN(node_eq, emacs_value _obj1, emacs_value _obj2);
 
 YEAST_DEFUN(instance_tree, emacs_value _instance);
+YEAST_DEFUN(parse_file, emacs_value _language, emacs_value _file);
+YEAST_DEFUN(current_p, emacs_value obj);
 YEAST_DEFUN(tree_root, emacs_value _tree);
 
 YEAST_DEFUN(node_type, emacs_value _node);
+YEAST_DEFUN(node_symbol, emacs_value _node);
 YEAST_DEFUN(node_child_count, emacs_value _node, emacs_value _anon);
 YEAST_DEFUN(node_child, emacs_value _node, emacs_value _index, emacs_value _anon);
 YEAST_DEFUN(node_start_byte, emacs_value _node);
 YEAST_DEFUN(node_end_byte, emacs_value _node);
 YEAST_DEFUN(node_byte_range, emacs_value _node);
 YEAST_DEFUN(node_child_for_byte, emacs_value _node, emacs_value _byte, emacs_value _anon);
+YEAST_DEFUN(node_start, emacs_value _node);
+YEAST_DEFUN(node_end, emacs_value _node);
+YEAST_DEFUN(node_range, emacs_value _node);
+YEAST_DEFUN(node_point_range, emacs_value _node);
+YEAST_DEFUN(node_child_for_pos, emacs_value _node, emacs_value _pos, emacs_value _anon);
+YEAST_DEFUN(node_at_range, emacs_value _tree, emacs_value _beg, emacs_value _end);
+YEAST_DEFUN(node_sexp, emacs_value _node, emacs_value _anon, emacs_value _ranges, emacs_value _depth);
 
 YEAST_DEFUN(next_sibling, emacs_value _node, emacs_value _anon);
 YEAST_DEFUN(prev_sibling, emacs_value _node, emacs_value _anon);
 YEAST_DEFUN(parent, emacs_value _node);
 
+/**
+ * Create a new tree object for the current tree of an instance.
+ * The object becomes the snapshot of the instance.
+ * @param env The active Emacs environment.
+ * @param instance The instance, which must have a tree.
+ * @return The tree object, or nil if out of memory.
+ */
+emacs_value yeast_instance_snapshot(emacs_env *env, yeast_instance *instance);
+
+/**
+ * Create a new node object belonging to a tree.
+ * @param env The active Emacs environment.
+ * @param tree The tree.
+ * @param node The node, which must belong to TREE.
+ * @return The node object, or nil if NODE is null.
+ */
+emacs_value yeast_tree_node(emacs_env *env, yeast_tree *tree, TSNode node);
+
 #endif /* YEAST_TRAVERSAL_H */
@@ -4,13 +4,19 @@
 #include <stdio.h>
 
 #include "interface.h"
+#include "yeast-batch.h"
+#include "yeast-cache.h"
+#include "yeast-cursor.h"
+#include "yeast-highlight.h"
 #include "yeast-instance.h"
+#include "yeast-query.h"
 #include "yeast-traversal.h"
 #include "yeast.h"
 
 yeast_type yeast_get_type(emacs_env *env, emacs_value _obj)
 {
-    if (!em_user_ptrp(env, _obj))
+    // Check the finalizer, so that user pointers from other modules are rejected
+    if (!em_user_ptrp(env, _obj) || env->get_user_finalizer(env, _obj) != yeast_finalize)
         return YEAST_UNKNOWN;
     yeast_header *obj = (yeast_header*) env->get_user_ptr(env, _obj);
     return obj->type;
@@ -24,45 +30,123 @@ bool yeast_assert_type(emacs_env *env, emacs_value obj, yeast_type type, emacs_v
     return false;
 }
 
+yeast_node *yeast_node_alloc(yeast_tree *tree)
+{
+    yeast_arena *arena = &tree->arena;
+
+    if (!arena->free) {
+        yeast_slab *slab = (yeast_slab*) malloc(sizeof(yeast_slab));
+        if (!slab)
+            return NULL;
+        slab->next = arena->slabs;
+        arena->slabs = slab;
+        for (int i = YEAST_SLAB_SIZE - 1; i >= 0; i--) {
+            slab->nodes[i].next_free = arena->free;
+            arena->free = &slab->nodes[i];
+        }
+    }
+
+    yeast_node *node = arena->free;
+    arena->free = node->next_free;
+    arena->live++;
+    tree->instance->handles.nodes++;
+    tree->instance->handles.live_nodes++;
+
+    node->header = (yeast_header) {YEAST_NODE, 0};
+    node->tree = tree;
+    node->next_free = NULL;
+    return node;
+}
+
+/**
+ * Free a tree, its arena and release its instance.
+ */
+static void destroy_tree(yeast_tree *tree)
+{
+    ts_tree_delete(tree->tree);
+    yeast_slab *slab = tree->arena.slabs;
+    while (slab) {
+        yeast_slab *next = slab->next;
+        free(slab);
+        slab = next;
+    }
+    yeast_instance *instance = tree->instance;
+    if (instance->snapshot == tree)
+        instance->snapshot = NULL;
+    instance->handles.live_trees--;
+    free(tree);
+    yeast_finalize(instance);
+}
+
+void yeast_retain(void *_obj)
+{
+    yeast_header *header = (yeast_header*) _obj;
+    __atomic_add_fetch(&header->refcount, 1, __ATOMIC_RELAXED);
+}
+
+/**
+ * Decrement the reference count of a yeast object.
+ * @return True iff the object should be destroyed.
+ */
+static bool release(yeast_header *header)
+{
+    return __atomic_sub_fetch(&header->refcount, 1, __ATOMIC_ACQ_REL) <= 0;
+}
+
 void yeast_finalize(void *_obj)
 {
     yeast_header *header = (yeast_header*) _obj;
 
     if (header->type == YEAST_INSTANCE) {
-        header->refcount--;
-        if (header->refcount <= 0) {
-            yeast_instance *instance = (yeast_instance*) _obj;
-            if (instance->tree)
-                ts_tree_delete(instance->tree);
-            ts_parser_delete(instance->parser);
-            free(instance);
-        }
+        if (release(header))
+            yeast_instance_destroy((yeast_instance*) _obj);
     }
     else if (header->type == YEAST_TREE) {
-        header->refcount--;
-        if (header->refcount <= 0) {
-            yeast_tree *tree = (yeast_tree*) _obj;
-            ts_tree_delete(tree->tree);
-            yeast_instance *instance = tree->instance;
-            free(tree);
-            yeast_finalize(instance);
-        }
+        yeast_tree *tree = (yeast_tree*) _obj;
+        if (release(header) && tree->arena.live == 0)
+            destroy_tree(tree);
     }
     else if (header->type == YEAST_NODE) {
-        // Nodes are not reference counted
+        // Nodes are not reference counted, they go back to the arena
         yeast_node *node = (yeast_node*) _obj;
-        yeast_finalize(node->tree);
-        free(node);
+        yeast_tree *tree = node->tree;
+        yeast_arena *arena = &tree->arena;
+        node->header.type = YEAST_UNKNOWN;
+        node->next_free = arena->free;
+        arena->free = node;
+        arena->live--;
+        tree->instance->handles.live_nodes--;
+        if (arena->live == 0 && __atomic_load_n(&tree->header.refcount, __ATOMIC_ACQUIRE) <= 0)
+            destroy_tree(tree);
+    }
+    else if (header->type == YEAST_CURSOR) {
+        // Cursors are not reference counted
+        yeast_cursor *cursor = (yeast_cursor*) _obj;
+        ts_tree_cursor_delete(&cursor->cursor);
+        yeast_finalize(cursor->tree);
+        free(cursor);
+    }
+    else if (header->type == YEAST_QUERY) {
+        // Queries are not reference counted
+        yeast_query_destroy((yeast_query*) _obj);
     }
 }
 
+typedef emacs_value (*func_0)(emacs_env*);
 typedef emacs_value (*func_1)(emacs_env*, emacs_value);
 typedef emacs_value (*func_2)(emacs_env*, emacs_value, emacs_value);
 typedef emacs_value (*func_3)(emacs_env*, emacs_value, emacs_value, emacs_value);
 typedef emacs_value (*func_4)(emacs_env*, emacs_value, emacs_value, emacs_value, emacs_value);
+typedef emacs_value (*func_5)(emacs_env*, emacs_value, emacs_value, emacs_value, emacs_value, emacs_value);
 
 #define GET_SAFE(arglist, nargs, index) ((index) < (nargs) ? (arglist)[(index)] : em_nil)
 
+static emacs_value yeast_dispatch_0(emacs_env *env, ptrdiff_t nargs, emacs_value *args, void *data)
+{
+    func_0 func = (func_0) data;
+    return func(env);
+}
+
 static emacs_value yeast_dispatch_1(emacs_env *env, ptrdiff_t nargs, emacs_value *args, void *data)
 {
     func_1 func = (func_1) data;
@@ -88,6 +172,13 @@ static emacs_value yeast_dispatch_4(emacs_env *env, ptrdiff_t nargs, emacs_value
                 GET_SAFE(args, nargs, 2), GET_SAFE(args, nargs, 3));
 }
 
+static emacs_value yeast_dispatch_5(emacs_env *env, ptrdiff_t nargs, emacs_value *args, void *data)
+{
+    func_5 func = (func_5) data;
+    return func(env, GET_SAFE(args, nargs, 0), GET_SAFE(args, nargs, 1),
+                GET_SAFE(args, nargs, 2), GET_SAFE(args, nargs, 3), GET_SAFE(args, nargs, 4));
+}
+
 #define DEFUN(ename, cname, min_nargs, max_nargs)                       \
     em_defun(env, (ename),                                              \
              env->make_function(                                        \
@@ -104,18 +195,63 @@ void yeast_init(emacs_env *env)
     DEFUN("yeast-node-eq", node_eq, 2, 2);
 
     DEFUN("yeast--make-instance", make_instance, 1, 1);
+    DEFUN("yeast--register-language", register_language, 2, 3);
+    DEFUN("yeast--language-types", language_types, 1, 2);
     DEFUN("yeast--parse", parse, 1, 1);
     DEFUN("yeast--edit", edit, 4, 4);
+    DEFUN("yeast--flush", flush, 1, 1);
+    DEFUN("yeast--instance-stats", instance_stats, 1, 1);
+    DEFUN("yeast--parser-stats", parser_stats, 0, 0);
+    DEFUN("yeast--global-stats", global_stats, 0, 0);
+    DEFUN("yeast--set-async", set_async, 2, 2);
+    DEFUN("yeast--parse-async", parse_async, 1, 1);
+    DEFUN("yeast--poll", poll, 1, 1);
+    DEFUN("yeast--parsing-p", parsing_p, 1, 1);
+    DEFUN("yeast--set-budget", set_budget, 2, 2);
+    DEFUN("yeast--parse-step", parse_step, 1, 2);
+    DEFUN("yeast--changed-ranges", changed_ranges, 1, 2);
+    DEFUN("yeast--line-count", line_count, 1, 1);
+    DEFUN("yeast--line-position", line_position, 2, 2);
 
     DEFUN("yeast--instance-tree", instance_tree, 1, 1);
+    DEFUN("yeast--parse-file", parse_file, 2, 2);
+    DEFUN("yeast--parse-files", parse_files, 2, 5);
+    DEFUN("yeast--cache-trim", cache_trim, 2, 2);
+    DEFUN("yeast--current-p", current_p, 1, 1);
     DEFUN("yeast--tree-root", tree_root, 1, 1);
     DEFUN("yeast--node-type", node_type, 1, 1);
+    DEFUN("yeast--node-symbol", node_symbol, 1, 1);
     DEFUN("yeast--node-child-count", node_child_count, 1, 2);
     DEFUN("yeast--node-child", node_child, 2, 3);
     DEFUN("yeast--node-start-byte", node_start_byte, 1, 1);
     DEFUN("yeast--node-end-byte", node_end_byte, 1, 1);
     DEFUN("yeast--node-byte-range", node_byte_range, 1, 1);
     DEFUN("yeast--node-child-for-byte", node_child_for_byte, 2, 3);
+    DEFUN("yeast--node-start", node_start, 1, 1);
+    DEFUN("yeast--node-end", node_end, 1, 1);
+    DEFUN("yeast--node-range", node_range, 1, 1);
+    DEFUN("yeast--node-child-for-pos", node_child_for_pos, 2, 3);
+    DEFUN("yeast--node-point-range", node_point_range, 1, 1);
+    DEFUN("yeast--node-at-range", node_at_range, 3, 3);
+    DEFUN("yeast--node-sexp", node_sexp, 1, 4);
+
+    DEFUN("yeast-cursor-p", cursor_p, 1, 1);
+    DEFUN("yeast--cursor-new", cursor_new, 1, 1);
+    DEFUN("yeast--cursor-goto-first-child", cursor_goto_first_child, 1, 1);
+    DEFUN("yeast--cursor-goto-next-sibling", cursor_goto_next_sibling, 1, 1);
+    DEFUN("yeast--cursor-goto-parent", cursor_goto_parent, 1, 1);
+    DEFUN("yeast--cursor-type", cursor_type, 1, 1);
+    DEFUN("yeast--cursor-symbol", cursor_symbol, 1, 1);
+    DEFUN("yeast--cursor-named-p", cursor_named_p, 1, 1);
+    DEFUN("yeast--cursor-byte-range", cursor_byte_range, 1, 1);
+    DEFUN("yeast--cursor-range", cursor_range, 1, 1);
+    DEFUN("yeast--cursor-node", cursor_node, 1, 1);
+
+    DEFUN("yeast-query-p", query_p, 1, 1);
+    DEFUN("yeast--query-compile", query_compile, 2, 2);
+    DEFUN("yeast--query-captures", query_captures, 1, 1);
+    DEFUN("yeast--query-run", query_run, 2, 4);
+    DEFUN("yeast--highlight", highlight, 4, 4);
 
     DEFUN("yeast--next-sibling", next_sibling, 1, 2);
     DEFUN("yeast--prev-sibling", prev_sibling, 1, 2);
@@ -1,6 +1,12 @@
 #include "emacs-module.h"
 #include "tree_sitter/runtime.h"
 
+#include "yeast-changes.h"
+#include "yeast-language.h"
+#include "yeast-lines.h"
+#include "yeast-offsets.h"
+#include "yeast-text.h"
+
 #ifndef YEAST_H
 #define YEAST_H
 
@@ -22,23 +28,31 @@
     extern const char *yeast_##name##__doc;                     \
     emacs_value yeast_##name(emacs_env *env, __VA_ARGS__)
 
+/**
+ * Macro that declares a function without arguments and its docstring variable.
+ * @param name The function name (without yeast_ prefix)
+ */
+#define YEAST_DEFUN_0(name)                                     \
+    extern const char *yeast_##name##__doc;                     \
+    emacs_value yeast_##name(emacs_env *env)
+
 /**
  * Assert that VAL is a symbol, signal an error and return otherwise.
  */
 #define YEAST_ASSERT_SYMBOL(val)                                        \
-    do { if (!em_assert_type(env, em_symbolp, (val))) return em_nil; } while (0)
+    do { if (!em_assert_type(env, em_symbol, em_symbolp, (val))) return em_nil; } while (0)
 
 /**
  * Assert that VAL is a string, signal an error and return otherwise.
  */
 #define YEAST_ASSERT_STRING(val)                                        \
-    do { if (!em_assert_type(env, em_stringp, (val))) return em_nil; } while (0)
+    do { if (!em_assert_type(env, em_string, em_stringp, (val))) return em_nil; } while (0)
 
 /**
  * Assert that VAL is an integer, signal an error and return otherwise.
  */
 #define YEAST_ASSERT_INTEGER(val)                                       \
-    do { if (!em_assert_type(env, em_integerp, (val))) return em_nil; } while (0)
+    do { if (!em_assert_type(env, em_integer, em_integerp, (val))) return em_nil; } while (0)
 
 /**
  * Extract a boolean from an emacs_value.
@@ -75,6 +89,18 @@
 #define YEAST_ASSERT_NODE(val)                                          \
     do { if (!yeast_assert_type(env, (val), YEAST_NODE, em_yeast_node_p)) return em_nil; } while (0)
 
+/**
+ * Assert that VAL is a cursor, signal an error and return otherwise.
+ */
+#define YEAST_ASSERT_CURSOR(val)                                        \
+    do { if (!yeast_assert_type(env, (val), YEAST_CURSOR, em_yeast_cursor_p)) return em_nil; } while (0)
+
+/**
+ * Assert that VAL is a query, signal an error and return otherwise.
+ */
+#define YEAST_ASSERT_QUERY(val)                                         \
+    do { if (!yeast_assert_type(env, (val), YEAST_QUERY, em_yeast_query_p)) return em_nil; } while (0)
+
 /**
  * Extract a yeast instance from an emacs_value.
  */
@@ -90,6 +116,16 @@
  */
 #define YEAST_EXTRACT_NODE(val) ((yeast_node*) env->get_user_ptr(env, (val)))
 
+/**
+ * Extract a yeast cursor from an emacs_value.
+ */
+#define YEAST_EXTRACT_CURSOR(val) ((yeast_cursor*) env->get_user_ptr(env, (val)))
+
+/**
+ * Extract a yeast query from an emacs_value.
+ */
+#define YEAST_EXTRACT_QUERY(val) ((yeast_query*) env->get_user_ptr(env, (val)))
+
 /**
  * Enum used to distinguish between various types of objects exposed.
  */
@@ -97,7 +133,9 @@ typedef enum {
     YEAST_UNKNOWN,
     YEAST_INSTANCE,
     YEAST_TREE,
-    YEAST_NODE
+    YEAST_NODE,
+    YEAST_CURSOR,
+    YEAST_QUERY
 } yeast_type;
 
 /**
@@ -109,31 +147,190 @@ typedef struct {
 } yeast_header;
 
 /**
- * Yeast instance: a parser with a canonical tree.
+ * Queue of edits that have been applied to the text of an instance,
+ * but not yet to its tree. Adjacent edits are merged, so COUNT (the number
+ * of edits received) may be larger than LENGTH.
+ */
+typedef struct {
+    TSInputEdit *edits;
+    uint32_t length;
+    uint32_t capacity;
+    uint32_t count;
+} yeast_edit_queue;
+
+/**
+ * Counters for the parses of an instance.
+ * EDITS is the number of edits merged into parses, and LAST_MERGED and
+ * MAX_MERGED the number merged into the last parse and the largest such number.
+ * PARSE_TIME is the time spent in the parser in nanoseconds, and MAX_PARSE_TIME
+ * the longest single run of the parser (a stepped parse runs it several times).
+ * READS is the number of chunks of text read by the parser, and BYTES_READ their
+ * total length.
+ */
+typedef struct {
+    uint64_t parses;
+    uint64_t edits;
+    uint32_t last_merged;
+    uint32_t max_merged;
+    uint64_t parse_time;
+    uint64_t max_parse_time;
+    uint64_t reads;
+    uint64_t bytes_read;
+} yeast_parse_counts;
+
+/**
+ * Counters for the trees and nodes handed out to Emacs by an instance:
+ * the number created, and the number not yet finalized.
+ * They are only updated on the main thread.
+ */
+typedef struct {
+    uint64_t trees;
+    uint64_t live_trees;
+    uint64_t nodes;
+    uint64_t live_nodes;
+} yeast_handle_counts;
+
+/**
+ * A parse running in a background thread.
+ */
+typedef struct yeast_job yeast_job;
+
+typedef struct yeast_tree yeast_tree;
+
+/**
+ * A parse that ran out of time, and can be resumed with the same PARSER.
+ * TREE is a copy of the old tree with the MERGED edits applied, or NULL if
+ * parsing from scratch. PARSER is NULL if there is no such parse.
+ * FULL is set when the text was replaced, so that the next parse must start
+ * from scratch even though the instance still has a tree to serve meanwhile.
  */
 typedef struct {
-    yeast_header header;
     TSParser *parser;
     TSTree *tree;
+    uint32_t merged;
+    bool full;
+} yeast_resume;
+
+/**
+ * Yeast instance: a canonical tree, and a native mirror of the text it was parsed from.
+ * Parsers are borrowed from the pool of the language while parsing.
+ * Edits to the text are queued, and the tree is only re-parsed when needed.
+ * In asynchronous mode, parsing happens in a background JOB while the
+ * previous tree is still served to readers. With a time BUDGET (in microseconds),
+ * a parse that runs out of time is suspended in RESUME, and likewise the
+ * previous tree is served until it's finished.
+ * GENERATION is incremented whenever the tree is replaced. SNAPSHOT is the
+ * tree last handed out to Emacs, if it still exists. It holds no reference.
+ * CHANGES holds the ranges that changed in recent parses.
+ * Instances that are visible to Emacs are linked in a list of live instances
+ * by PREV and NEXT, to aggregate their counters.
+ */
+typedef struct yeast_instance {
+    yeast_header header;
+    yeast_language *language;
+    TSTree *tree;
+    uint64_t generation;
+    yeast_tree *snapshot;
+    yeast_text text;
+    yeast_offsets offsets;
+    yeast_lines lines;
+    yeast_edit_queue queue;
+    yeast_parse_counts counts;
+    yeast_handle_counts handles;
+    yeast_changes changes;
+    yeast_job *job;
+    bool async;
+    uint64_t budget;
+    yeast_resume resume;
+    struct yeast_instance *prev;
+    struct yeast_instance *next;
 } yeast_instance;
 
 /**
- * Yeast tree.
+ * Yeast node.
+ * Nodes are allocated from the arena of their tree. A free node is
+ * linked to the next free one in the arena.
+ */
+typedef struct yeast_node {
+    yeast_header header;
+    yeast_tree *tree;
+    TSNode node;
+    struct yeast_node *next_free;
+} yeast_node;
+
+/**
+ * Number of nodes in each slab of a node arena.
+ */
+#define YEAST_SLAB_SIZE 64
+
+/**
+ * Slab of nodes in a node arena.
+ */
+typedef struct yeast_slab {
+    struct yeast_slab *next;
+    yeast_node nodes[YEAST_SLAB_SIZE];
+} yeast_slab;
+
+/**
+ * Arena of nodes belonging to a tree.
+ * Nodes are only created and finalized on the main thread, so LIVE (the number
+ * of nodes in use) is a plain counter. All slabs are freed together with the tree.
  */
 typedef struct {
+    yeast_slab *slabs;
+    yeast_node *free;
+    uint32_t live;
+} yeast_arena;
+
+/**
+ * Yeast tree: a snapshot of the tree of an instance at a given generation.
+ * A tree is destroyed when its reference count is zero and it has no live nodes.
+ */
+struct yeast_tree {
     yeast_header header;
     yeast_instance *instance;
     TSTree *tree;
-} yeast_tree;
+    uint64_t generation;
+    yeast_arena arena;
+};
 
 /**
- * Yeast node.
+ * Yeast cursor: a position in a tree that can be moved in place.
  */
 typedef struct {
     yeast_header header;
     yeast_tree *tree;
-    TSNode node;
-} yeast_node;
+    TSTreeCursor cursor;
+} yeast_cursor;
+
+/**
+ * A step in a compiled query pattern. The steps of a pattern are stored in
+ * preorder, and the subpatterns of a step are the steps up to END.
+ * SYMBOLS is a bitset of the grammar symbols the step matches, or NULL if it
+ * matches any named node.
+ */
+typedef struct {
+    uint64_t *symbols;
+    bool error;
+    uint32_t end;
+    int32_t capture;
+} yeast_query_step;
+
+/**
+ * Yeast query: a list of patterns compiled for a language.
+ * PATTERNS holds the index of the first step of each pattern.
+ */
+typedef struct {
+    yeast_header header;
+    yeast_language *language;
+    uint32_t nsymbols;
+    yeast_query_step *steps;
+    uint32_t nsteps;
+    uint32_t *patterns;
+    uint32_t npatterns;
+    char **captures;
+    uint32_t ncaptures;
+} yeast_query;
 
 /**
  * Return the yeast object type stored by en Emacs value.
@@ -153,8 +350,24 @@ yeast_type yeast_get_type(emacs_env *env, emacs_value _obj);
  */
 bool yeast_assert_type(emacs_env *env, emacs_value obj, yeast_type type, emacs_value predicate);
 
+/**
+ * Allocate a node from the arena of a tree.
+ * The fields of the node are left uninitialized, except for the header.
+ * @param tree The tree.
+ * @return The node, or NULL if out of memory.
+ */
+yeast_node *yeast_node_alloc(yeast_tree *tree);
+
+/**
+ * Increment the reference count of a yeast object.
+ * This is safe to call from any thread.
+ * @param _obj The object.
+ */
+void yeast_retain(void *_obj);
+
 /**
  * Finalize and potentially destroy a yeast object.
+ * This is safe to call from any thread.
  * @param _obj The object to finalize
  */
 void yeast_finalize(void *_obj);
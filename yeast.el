@@ -47,44 +47,61 @@
   (load-file libyeast--module-file))
 
 
-;;; Utility macros
-
-(defmacro yeast-with-unibyte (&rest body)
-  (declare (indent 0))
-  `(save-restriction
-     (widen)
-     (let ((inhibit-redisplay t)
-           (multibyte enable-multibyte-characters))
-       (set-buffer-multibyte nil)
-       (unwind-protect
-           (progn ,@body)
-         (set-buffer-multibyte multibyte)))))
+;;; Tracking changes
 
+(defvar yeast-parse-asynchronously nil
+  "If non-nil, re-parse in a background thread after changes.
+The previous tree remains available until the new one is ready.")
 
-;;; Tracking changes
+(defvar yeast-parse-budget nil
+  "If non-nil, the longest time in microseconds a parse may block Emacs.
+A parse that runs out of time is resumed from a timer, and the previous
+tree remains available until it is finished.")
 
-(defvar-local yeast--before-change-data nil)
+(defvar yeast-tree-published-hook nil
+  "Hook run in a buffer when a tree parsed in the background is published.")
 
-(defun yeast--before-change (beg end)
-  (setq-local yeast--before-change-data
-              (cons beg (buffer-substring-no-properties beg end))))
+(defvar-local yeast--poll-timer nil)
 
 (defun yeast--after-change (beg end len)
-  (let* ((pre-beg (car yeast--before-change-data))
-         (pre-str (cdr yeast--before-change-data))
-         (i1 (- beg pre-beg))
-         (i2 (+ i1 len))
-         (nbytes (string-bytes (substring pre-str i1 i2))))
-    (setq yeast--before-change-data
-          (cons pre-beg
-                (concat (substring pre-str 0 i1)
-                        (buffer-substring-no-properties beg end)
-                        (substring pre-str i2))))
-    (yeast-with-unibyte
-      (yeast--edit yeast--instance
-                   (1- (position-bytes beg))
-                   (1- (position-bytes end))
-                   nbytes))))
+  ;; A change the instance can't follow re-reads the whole buffer
+  (save-restriction
+    (widen)
+    (yeast--edit yeast--instance beg end len))
+  (cond
+   (yeast-parse-budget
+    (yeast--schedule-poll))
+   (yeast-parse-asynchronously
+    (yeast--parse-async yeast--instance)
+    (yeast--schedule-poll))))
+
+(defun yeast--schedule-poll ()
+  (unless yeast--poll-timer
+    (setq yeast--poll-timer
+          (run-with-timer 0.05 0.05 #'yeast--poll-buffer (current-buffer)))))
+
+(defun yeast--cancel-poll ()
+  (when yeast--poll-timer
+    (cancel-timer yeast--poll-timer)
+    (setq yeast--poll-timer nil)))
+
+(defun yeast--poll-buffer (buffer)
+  (when (buffer-live-p buffer)
+    (with-current-buffer buffer
+      (cond
+       ((not yeast--instance)
+        (yeast--cancel-poll))
+       (yeast-parse-budget
+        (when (yeast--parse-step yeast--instance yeast-parse-budget)
+          (run-hooks 'yeast-tree-published-hook)
+          (yeast--cancel-poll)))
+       (t
+        (when (yeast--poll yeast--instance)
+          (run-hooks 'yeast-tree-published-hook))
+        ;; Parse edits that came in while the last parse was running
+        (yeast--parse-async yeast--instance)
+        (unless (yeast--parsing-p yeast--instance)
+          (yeast--cancel-poll)))))))
 
 
 ;;; Yeast minor mode
@@ -116,14 +133,24 @@
    ((derived-mode-p 'typescript-mode) 'typescript)))
 
 (defun yeast-parse ()
-  "Parse the buffer from scratch."
+  "Parse the buffer from scratch.
+With `yeast-parse-budget', the parse is finished from a timer."
   (when yeast--instance
-    (yeast-with-unibyte
-      (yeast--parse yeast--instance))))
+    (save-restriction
+      (widen)
+      (yeast--parse yeast--instance))
+    (when (yeast--parsing-p yeast--instance)
+      (yeast--schedule-poll))))
+
+(defun yeast-parse-file (language file)
+  "Parse FILE as LANGUAGE without visiting it, and return the tree.
+Node positions in the tree are as if FILE was visited in a buffer."
+  (yeast--parse-file language (expand-file-name file)))
 
 (defun yeast-root-node ()
-  "Get the current root node."
-  (yeast--tree-root (yeast--instance-tree yeast--instance)))
+  "Get the current root node, or nil if the buffer is not parsed yet."
+  (when-let ((tree (yeast--instance-tree yeast--instance)))
+    (yeast--tree-root tree)))
 
 (defvar yeast-mode-map
   (make-sparse-keymap)
@@ -137,64 +164,213 @@
       (if-let ((lang (yeast-detect-language)))
           (progn
             (setq-local yeast--instance (yeast--make-instance lang))
+            (yeast--set-async yeast--instance yeast-parse-asynchronously)
+            (yeast--set-budget yeast--instance yeast-parse-budget)
             (yeast-parse)
-            (add-hook 'before-change-functions 'yeast--before-change nil t)
-            (add-hook 'after-change-functions 'yeast--after-change nil t))
+            (add-hook 'after-change-functions 'yeast--after-change nil t)
+            (add-hook 'kill-buffer-hook 'yeast--cancel-poll nil t))
         (user-error "Yeast does not support this major mode")
         (setq-local yeast-mode nil))
-    (remove-hook 'before-change-functions 'yeast--before-change t)
     (remove-hook 'after-change-functions 'yeast--after-change t)
+    (remove-hook 'kill-buffer-hook 'yeast--cancel-poll t)
+    (yeast--cancel-poll)
     (setq-local yeast--instance nil)))
 
 
 ;;; Convenience functionality
 
 (defun yeast--node-at-point (point mark)
-  (let* ((min-char (min point mark))
-         (max-char (max (1- (max point mark)) min-char))
-         (min-byte (position-bytes min-char))
-         (max-byte (position-bytes max-char))
-         (node (yeast-root-node))
-         prev-node)
-    ;; Descend until we find the youngest node containing the range
-    (while (not (null node))
-      (let* ((min-node (yeast--node-child-for-byte node min-byte))
-             (max-node (yeast--node-child-for-byte node max-byte))
-             (byte-range (and min-node (yeast--node-byte-range min-node))))
-        (setq prev-node node
-              node (and (yeast-node-eq min-node max-node)
-                        (>= min-byte (car byte-range))
-                        (<= max-byte (cdr byte-range))
-                        min-node))))
-    ;; Ascend until we find the oldest node that is not wider than the youngest
-    (let ((parent (yeast--parent prev-node))
-          (range (yeast--node-byte-range prev-node)))
-      (while (and parent (equal range (yeast--node-byte-range parent)))
-        (setq prev-node parent
-              parent (yeast--parent prev-node))))
-    prev-node))
+  (when-let ((tree (yeast--instance-tree yeast--instance)))
+    (car (yeast--node-at-range tree point mark))))
+
+(defun yeast--select-range (range)
+  (when range
+    (goto-char (car range))
+    (set-mark (cdr range))))
 
 (defun yeast--select-node (node)
   (when node
-    (let ((byte-range (yeast--node-byte-range node)))
-      (goto-char (byte-to-position (car byte-range)))
-      (set-mark (1+ (byte-to-position (cdr byte-range)))))))
+    (yeast--select-range (yeast--node-range node))))
 
 (defun yeast-node-children (node &optional anon)
   "Get the children of NODE.
 If ANON is nil, get only the named children."
   (when node
-    (let ((nchildren (yeast--node-child-count node anon)))
-      (cl-loop for i below nchildren collect (yeast--node-child node i anon)))))
-
-(defun yeast-ast-sexp (&optional node anon)
+    (let ((cursor (yeast--cursor-new node))
+          children)
+      (when (yeast--cursor-goto-first-child cursor)
+        (cl-loop do (when (or anon (yeast--cursor-named-p cursor))
+                      (push (yeast--cursor-node cursor) children))
+                 while (yeast--cursor-goto-next-sibling cursor)))
+      (nreverse children))))
+
+(defun yeast-ast-sexp (&optional node anon ranges depth)
   "Convert NODE to an s-expression.
 If NODE is nil, use the current root node.
-If ANON is nil, only use the named nodes."
-  (let* ((node (or node (yeast-root-node)))
-         (children (yeast-node-children node anon)))
-    `(,(yeast--node-type node)
-      ,@(cl-loop for node in children collect (yeast-ast-sexp node anon)))))
+If ANON is nil, only use the named nodes.
+See `yeast--node-sexp' for the meaning of RANGES and DEPTH."
+  (when-let ((node (or node (yeast-root-node))))
+    (yeast--node-sexp node anon ranges depth)))
+
+
+;;; Queries
+
+(defvar yeast--queries (make-hash-table :test 'equal)
+  "Compiled queries, keyed by (LANGUAGE . PATTERNS).")
+
+(defun yeast-compile-query (language patterns)
+  "Get a query for PATTERNS in LANGUAGE, compiling it only once.
+See `yeast--query-compile' for the pattern syntax."
+  (let ((key (cons language patterns)))
+    (or (gethash key yeast--queries)
+        (puthash key (yeast--query-compile language patterns) yeast--queries))))
+
+(defun yeast-query (patterns &optional beg end)
+  "Find the nodes captured by PATTERNS in the current buffer.
+If BEG and END are given, only consider nodes overlapping that region.
+Return a list of elements (CAPTURE BEG . END)."
+  (let ((query (yeast-compile-query (yeast-detect-language) patterns))
+        (root (yeast-root-node)))
+    (when root
+      (yeast--query-matches query (yeast--query-run query root beg end)))))
+
+(defun yeast--query-matches (query matches)
+  "Convert MATCHES of QUERY to a list of elements (CAPTURE BEG . END)."
+  (let ((captures (yeast--query-captures query)))
+    (cl-loop for i from 0 below (length matches) by 4
+             collect (cons (aref captures (aref matches (1+ i)))
+                           (cons (aref matches (+ i 2)) (aref matches (+ i 3)))))))
+
+(defvar yeast-cache-directory nil
+  "If non-nil, a directory where `yeast-parse-files' caches query results.
+Results are keyed by file contents, so unchanged files are not parsed
+again, even in a later Emacs session.")
+
+(defvar yeast-cache-max-size (* 64 1024 1024)
+  "The size in bytes above which `yeast-cache-directory' is trimmed.
+The least recently used entries are deleted first.")
+
+(defun yeast-parse-files (language files &optional patterns)
+  "Parse FILES as LANGUAGE in parallel, without visiting them.
+Return a vector with a tree for each file, or nil if it could not be
+parsed. If PATTERNS is given, each element is instead the list of nodes
+captured by PATTERNS in the file, as returned by `yeast-query'.
+These are cached in `yeast-cache-directory'."
+  (let* ((query (and patterns (yeast-compile-query language patterns)))
+         (cache (and query yeast-cache-directory
+                     (expand-file-name yeast-cache-directory)))
+         (results (yeast--parse-files language (mapcar #'expand-file-name files)
+                                      query nil cache)))
+    (when cache
+      (yeast--cache-trim cache yeast-cache-max-size))
+    (if query
+        (cl-map 'vector (lambda (matches)
+                          (and matches (yeast--query-matches query matches)))
+                results)
+      results)))
+
+
+;;; Highlighting
+
+(defvar yeast-highlight-patterns nil
+  "Alist of highlighting patterns per language.
+Each element is (LANGUAGE . PATTERNS), where PATTERNS is a list of
+patterns as described in `yeast--query-compile'.  The name of each
+capture is the face to apply.  Languages without an entry get patterns
+from `yeast-highlight-default-patterns'.")
+
+(defvar yeast-highlight-default-rules
+  '(("comment" named font-lock-comment-face)
+    ("string\\|char_literal\\|heredoc" named font-lock-string-face)
+    ("number\\|integer\\|float\\|int_literal" named font-lock-constant-face)
+    ("\\`\\(primitive_type\\|type_identifier\\|predefined_type\\)\\'" named font-lock-type-face)
+    ("\\`[a-z]+\\'" anonymous font-lock-keyword-face))
+  "Rules for deriving highlighting patterns from the node types of a language.
+Each element is (REGEXP KIND FACE): node types of KIND (`named' or
+`anonymous') whose name matches REGEXP get FACE.  If several rules
+match a type, the first one is used.")
+
+(defvar yeast--highlight-queries (make-hash-table :test 'eq)
+  "Compiled highlighting queries, keyed by language.")
+
+(defun yeast-highlight-default-patterns (language)
+  "Derive highlighting patterns for LANGUAGE from `yeast-highlight-default-rules'."
+  (let ((case-fold-search nil)
+        patterns seen)
+    (pcase-dolist (`(,regexp ,kind ,face) yeast-highlight-default-rules)
+      (cl-loop for type across (yeast--language-types language kind)
+               for name = (and type (symbol-name type))
+               when (and name (string-match-p regexp name)
+                         (not (member (cons kind name) seen)))
+               do (push (cons kind name) seen)
+               (push (if (eq kind 'named) type name) patterns)
+               (push (intern (concat "@" (symbol-name face))) patterns)))
+    (nreverse patterns)))
+
+(defun yeast--highlight-query (language)
+  "Get the compiled highlighting query for LANGUAGE."
+  (or (gethash language yeast--highlight-queries)
+      (puthash language
+               (yeast--query-compile
+                language (or (alist-get language yeast-highlight-patterns)
+                             (yeast-highlight-default-patterns language)))
+               yeast--highlight-queries)))
+
+(defvar-local yeast--highlight-generation nil
+  "Generation of the last tree whose changes were refontified.")
+
+(defun yeast--refontify-changes ()
+  "Mark the ranges that changed since the last highlighted tree for refontification."
+  (pcase-let ((`(,generation . ,ranges)
+               (yeast--changed-ranges yeast--instance yeast--highlight-generation)))
+    (if (eq ranges t)
+        (jit-lock-refontify)
+      (pcase-dolist (`(,beg . ,end) ranges)
+        (jit-lock-refontify beg end)))
+    (setq yeast--highlight-generation generation)))
+
+(defun yeast--apply-faces (beg end runs)
+  "Replace the faces between BEG and END by RUNS.
+RUNS is a vector [BEG END FACE ...] as returned by `yeast--highlight'.
+Text in the region that isn't in a run gets no face."
+  (put-text-property beg end 'face nil)
+  (let ((i 0)
+        (length (length runs)))
+    (while (< i length)
+      (put-text-property (aref runs i) (aref runs (1+ i)) 'face (aref runs (+ i 2)))
+      (setq i (+ i 3)))))
+
+(defun yeast--fontify-region (beg end)
+  "Apply faces between BEG and END from the current tree."
+  (when yeast--instance
+    (save-restriction
+      (widen)
+      ;; Until the first parse is finished, there is nothing to highlight
+      (when-let ((tree (yeast--instance-tree yeast--instance)))
+        (yeast--refontify-changes)
+        (with-silent-modifications
+          (yeast--apply-faces
+           beg end
+           (yeast--highlight tree (yeast--highlight-query (yeast-detect-language))
+                             beg end)))))))
+
+(define-minor-mode yeast-highlight-mode
+  "Syntax highlighting from yeast trees, instead of font-lock keywords."
+  nil nil nil
+  (if yeast-highlight-mode
+      (progn
+        (unless yeast-mode
+          (yeast-mode))
+        (font-lock-mode -1)
+        (setq yeast--highlight-generation nil)
+        (jit-lock-register #'yeast--fontify-region)
+        (add-hook 'yeast-tree-published-hook #'yeast--refontify-changes nil t))
+    (jit-lock-unregister #'yeast--fontify-region)
+    (remove-hook 'yeast-tree-published-hook #'yeast--refontify-changes t)
+    (with-silent-modifications
+      (save-restriction
+        (widen)
+        (remove-text-properties (point-min) (point-max) '(face nil))))))
 
 
 ;;; Traversal by selection
@@ -215,19 +391,17 @@ If ANON is nil, only use the named nodes."
 
 (defun yeast-select-parent-at-point (point mark)
   (interactive (list (point) (if (use-region-p) (mark) (point))))
-  (let* ((node (yeast--node-at-point point mark))
-         (range (yeast--node-byte-range node)))
-    ;; Get the closest ancestor with a wider byte range
-    (while (and node (equal range (yeast--node-byte-range node)))
-      (setq node (yeast--parent node)))
-    (yeast--select-node node)))
+  ;; The second range is that of the closest ancestor with a wider range
+  (when-let ((tree (yeast--instance-tree yeast--instance)))
+    (let ((ranges (cdr (yeast--node-at-range tree point mark))))
+      (yeast--select-range (cadr ranges)))))
 
 (defun yeast-select-first-child-at-point (point mark)
   (interactive (list (point) (if (use-region-p) (mark) (point))))
   (let* ((node (yeast--node-at-point point mark))
-         (range (yeast--node-byte-range node)))
-    ;; Get the primary descendant with a narrower byte range
-    (while (and (equal range (yeast--node-byte-range node))
+         (range (yeast--node-range node)))
+    ;; Get the primary descendant with a narrower range
+    (while (and (equal range (yeast--node-range node))
                 (< 0 (yeast--node-child-count node)))
       (setq node (yeast--node-child node 0)))
     (yeast--select-node node)))
@@ -241,12 +415,12 @@ If ANON is nil, only use named nodes."
   (require 'wid-edit)
   (require 'tree-widget)
   (widget-convert 'tree-widget
-                  :tag (format "%s (%d - %d) (%d - %d)"
-                               (yeast--node-type node)
-                               (car (yeast--node-byte-range node))
-                               (cdr (yeast--node-byte-range node))
-                               (byte-to-position (car (yeast--node-byte-range node)))
-                               (byte-to-position (cdr (yeast--node-byte-range node))))
+                  :tag (let ((byte-range (yeast--node-byte-range node))
+                             (range (yeast--node-range node)))
+                         (format "%s (%d - %d) (%d - %d)"
+                                 (yeast--node-type node)
+                                 (car byte-range) (cdr byte-range)
+                                 (car range) (cdr range)))
                   :open t
                   :args (cl-loop for node in (yeast-node-children node anon)
                                  collect (yeast--tree-widget node anon))))
@@ -255,8 +429,9 @@ If ANON is nil, only use named nodes."
   "Show the AST in a separate buffer.
 If ANON is nil, only use the named nodes."
   (interactive "P")
-  (let ((buffer (generate-new-buffer "*yeast-tree*"))
-        (widget (yeast--tree-widget (yeast-root-node) anon)))
+  (let* ((root (or (yeast-root-node) (user-error "The buffer is not parsed yet")))
+         (buffer (generate-new-buffer "*yeast-tree*"))
+         (widget (yeast--tree-widget root anon)))
     (with-current-buffer buffer
       (setq-local buffer-read-only t)
       (let ((inhibit-read-only t))